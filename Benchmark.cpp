@@ -0,0 +1,498 @@
+/*
+    Benchmark: Time the converter and matrix tools on synthetic data.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include "SOFT2Matrix.hpp"
+#include "MatrixStats.hpp"
+#include "Profile.hpp"
+#include "RowReader.hpp"
+#include "RowRanker.hpp"
+#include "RuntimeException.hpp"
+#include "StringArena.hpp"
+#include "SyntheticData.hpp"
+#include "TransposeWriter.hpp"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <set>
+#include <vector>
+
+namespace po = boost::program_options;
+
+// Prints one result line: the time taken, the rate at which aItems were
+// done and, if aBytes is given, the rate in MB/s.
+static void
+report(const std::string& aName, uint64_t aNanoseconds, uint64_t aItems,
+       const char* aUnit, uint64_t aBytes = 0)
+{
+  double seconds = aNanoseconds / 1E9;
+  printf("%-24s %9.3f s %14.0f %s/s", aName.c_str(), seconds,
+         seconds > 0 ? aItems / seconds : 0.0, aUnit);
+  if (aBytes != 0)
+    printf(" %10.1f MB/s", seconds > 0 ? aBytes / 1E6 / seconds : 0.0);
+  printf("\n");
+  fflush(stdout);
+}
+
+// Sends std::cout nowhere while it is in scope, so that the progress the
+// converter prints does not get mixed up with the results.
+class QuietCout
+{
+public:
+  QuietCout()
+    : mNull("/dev/null"), mOld(std::cout.rdbuf(mNull.rdbuf()))
+  {
+  }
+
+  ~QuietCout()
+  {
+    std::cout.rdbuf(mOld);
+  }
+
+private:
+  std::ofstream mNull;
+  std::streambuf* mOld;
+};
+
+// Removes a directory and everything in it at the end of the scope, however
+// the scope is left, unless aRemove is false.
+class ScopedRemoveDir
+{
+public:
+  ScopedRemoveDir(const fs::path& aDir, bool aRemove)
+    : mDir(aDir), mRemove(aRemove)
+  {
+  }
+
+  ~ScopedRemoveDir()
+  {
+    boost::system::error_code ec;
+    if (mRemove)
+      fs::remove_all(mDir, ec);
+  }
+
+private:
+  fs::path mDir;
+  bool mRemove;
+};
+
+// The benchmarks of SOFT2Matrix's own steps, which need at its internals.
+class SOFT2MatrixBenchmark
+{
+public:
+  static void
+  findHGNCId(const fs::path& aWorkdir, const std::string& aSOFT,
+             const std::string& aHGNC, uint32_t aGenes, uint32_t aNames,
+             uint64_t aSeed)
+  {
+    boost::random::mt19937 rng(aSeed);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < aNames; i++)
+      names.push_back(syntheticSymbol(rng, aGenes));
+
+    SOFTInput input(aSOFT);
+    SOFT2Matrix s2m(input, outdir(aWorkdir, "find_hgnc_id"), NULL, false);
+    s2m.loadHGNCDatabase(aHGNC);
+
+    uint32_t found = 0;
+    uint64_t t0 = Profile::now();
+    for (uint32_t i = 0; i < aNames; i++)
+      found += s2m.findHGNCIdByName(names[i]) != 0;
+    report("find_hgnc_id", Profile::now() - t0, aNames, "names");
+    if (found == 0)
+      throw RuntimeException("No synthetic names were found in HGNC.");
+  }
+
+  static void
+  sampleTableDone(const fs::path& aWorkdir, const std::string& aSOFT,
+                  const std::string& aHGNC, uint32_t aSamples,
+                  uint64_t aSeed)
+  {
+    QuietCout quiet;
+    SOFTInput input(aSOFT);
+    SOFT2Matrix s2m(input, outdir(aWorkdir, "sample_table_done"), NULL,
+                    false);
+    s2m.loadHGNCDatabase(aHGNC);
+
+    // Map the platform, and stop there.
+    boost::string_ref l;
+    s2m.processLine = &SOFT2Matrix::processPlatformIntro;
+    while (s2m.processLine != &SOFT2Matrix::processSampleIntro &&
+           input.nextLine(l))
+      (s2m.*s2m.processLine)(l);
+    if (s2m.processLine != &SOFT2Matrix::processSampleIntro)
+      throw RuntimeException("The synthetic SOFT file has no platform.");
+
+    boost::random::mt19937 rng(aSeed);
+    boost::random::uniform_01<double> u;
+    std::vector<double> values(s2m.mProbesetCount);
+    for (uint32_t i = 0; i < values.size(); i++)
+      values[i] = u(rng) < 0.02 ?
+        std::numeric_limits<double>::quiet_NaN() : u(rng) * 16;
+
+    uint64_t ns = 0;
+    for (uint32_t s = 0; s < aSamples; s++)
+    {
+      memcpy(s2m.mProbesets, &values[0], sizeof(double) * values.size());
+      uint64_t t0 = Profile::now();
+      s2m.sampleTableDone();
+      ns += Profile::now() - t0;
+    }
+    report("sample_table_done", ns, aSamples, "samples",
+           static_cast<uint64_t>(aSamples) * values.size() * sizeof(double));
+  }
+
+  static std::string
+  outdir(const fs::path& aWorkdir, const std::string& aName)
+  {
+    fs::path p = aWorkdir / aName;
+    fs::create_directories(p);
+    return p.string();
+  }
+};
+
+static void
+benchParseLines(const std::string& aName, const std::string& aSOFT)
+{
+  SOFTInput input(aSOFT);
+  boost::string_ref l, f;
+  uint64_t lines = 0, bytes = 0, fields = 0;
+
+  uint64_t t0 = Profile::now();
+  while (input.nextLine(l))
+  {
+    lines++;
+    bytes += l.size() + 1;
+    TabFields tf(l);
+    while (tf.next(f))
+      fields++;
+  }
+  report(aName, Profile::now() - t0, lines, "lines", bytes);
+}
+
+static void
+benchProbesetLookup(uint32_t aProbesets, uint32_t aLookups, uint64_t aSeed)
+{
+  StringArena ids;
+  char buf[32];
+  for (uint32_t p = 0; p < aProbesets; p++)
+  {
+    snprintf(buf, sizeof(buf), "P%u_at", p);
+    ids.intern(buf);
+  }
+
+  // A sample table asks for its probesets in order, with a few the
+  // platform does not have.
+  boost::random::mt19937 rng(aSeed);
+  boost::random::uniform_01<double> u;
+  std::vector<std::string> wanted;
+  for (uint32_t i = 0; i < aLookups; i++)
+  {
+    snprintf(buf, sizeof(buf), u(rng) < 0.01 ? "Q%u_at" : "P%u_at",
+             i % aProbesets);
+    wanted.push_back(buf);
+  }
+
+  uint32_t found = 0;
+  uint64_t t0 = Profile::now();
+  for (uint32_t i = 0; i < aLookups; i++)
+    found += ids.find(wanted[i]) != StringArena::kNotFound;
+  report("probeset_lookup", Profile::now() - t0, aLookups, "lookups");
+  if (found == 0)
+    throw RuntimeException("No probesets were found.");
+}
+
+// Ranks every row of the matrix, as RankTransformDataset does for each row
+// it reads, and with quantile normalisation as well.
+static void
+benchRankRows(const std::string& aData, uint32_t aArrays, uint32_t aGenes)
+{
+  std::vector<double> rows(static_cast<uint64_t>(aArrays) * aGenes);
+  FILE* f = fopen(aData.c_str(), "r");
+  if (f == NULL || fread(&rows[0], sizeof(double), rows.size(), f) !=
+      rows.size())
+    throw RuntimeException("Cannot read the synthetic data file.");
+  fclose(f);
+
+  RankWorkspace ws(aGenes);
+  RowRanker ranker(aGenes, false);
+  uint64_t t0 = Profile::now();
+  for (uint32_t a = 0; a < aArrays; a++)
+    ranker.rankRow(&rows[static_cast<uint64_t>(a) * aGenes], ws);
+  report("rank_row", Profile::now() - t0, aArrays, "rows",
+         rows.size() * sizeof(double));
+
+  RowRanker qranker(aGenes, true);
+  t0 = Profile::now();
+  for (uint32_t a = 0; a < aArrays; a++)
+    qranker.accumulateRankAverages(&rows[static_cast<uint64_t>(a) * aGenes],
+                                   ws);
+  qranker.finishRankAverages();
+  for (uint32_t a = 0; a < aArrays; a++)
+    qranker.rankRow(&rows[static_cast<uint64_t>(a) * aGenes], ws);
+  report("rank_row_qnorm", Profile::now() - t0, aArrays, "rows",
+         rows.size() * sizeof(double));
+}
+
+// The band loop of InvertData, from data to inverse_data.
+static void
+benchInvertData(const fs::path& aMatrix, uint32_t aArrays, uint32_t aGenes)
+{
+  static const uint32_t kConcurrentRows = 3000;
+
+  uint64_t t0 = Profile::now();
+  {
+    RowReader dataf((aMatrix / "data").string(), aGenes, kConcurrentRows, 2);
+    TransposeWriter invdataf((aMatrix / "inverse_data").string(), aArrays,
+                             aGenes, kConcurrentRows);
+    uint32_t nrows;
+    const double* bigbuf;
+    while ((bigbuf = dataf.nextBlock(nrows)) != NULL)
+      invdataf.addRows(bigbuf, nrows);
+    invdataf.finish();
+  }
+  report("invert_data", Profile::now() - t0, aArrays, "rows",
+         static_cast<uint64_t>(aArrays) * aGenes * sizeof(double));
+}
+
+// Reads, ranks and writes out every row, as RankTransformDataset does.
+static void
+benchRankTransform(const fs::path& aMatrix, uint32_t aArrays,
+                   uint32_t aGenes)
+{
+  uint64_t t0 = Profile::now();
+  {
+    RowReader dataf((aMatrix / "data").string(), aGenes);
+    RowRanker ranker(aGenes, false);
+    RankWorkspace ws(aGenes);
+    FILE* out = fopen((aMatrix / "ranks").string().c_str(), "w");
+    if (out == NULL)
+      throw RuntimeException("Cannot open the ranks file.");
+    const double* row;
+    while ((row = dataf.nextRow()) != NULL)
+    {
+      ranker.rankRow(row, ws);
+      fwrite(ws.mRanks, sizeof(double), aGenes, out);
+    }
+    fclose(out);
+  }
+  report("rank_transform", Profile::now() - t0, aArrays, "rows",
+         static_cast<uint64_t>(aArrays) * aGenes * sizeof(double));
+}
+
+// Gathers the statistics of every row and column, as SummariseMatrix does.
+static void
+benchMatrixStats(const fs::path& aMatrix, uint32_t aArrays, uint32_t aGenes)
+{
+  uint64_t t0 = Profile::now();
+  {
+    RowReader dataf((aMatrix / "data").string(), aGenes);
+    MatrixStats stats(aGenes);
+    uint32_t nrows;
+    const double* rows;
+    while ((rows = dataf.nextBlock(nrows)) != NULL)
+      stats.addRows(rows, nrows);
+    stats.write(aMatrix.string(), aMatrix.string(), false);
+  }
+  report("matrix_stats", Profile::now() - t0, aArrays, "rows",
+         static_cast<uint64_t>(aArrays) * aGenes * sizeof(double));
+}
+
+// Converts a whole SOFT file, as SOFT2Matrix does.
+static void
+benchSOFT2Matrix(const std::string& aName, const fs::path& aWorkdir,
+                 const std::string& aSOFT, const std::string& aHGNC,
+                 uint64_t aBytes, uint32_t aSamples)
+{
+  fs::path out = aWorkdir / aName;
+  fs::create_directories(out);
+
+  uint64_t t0 = Profile::now();
+  {
+    QuietCout quiet;
+    SOFTInput input(aSOFT);
+    SOFT2Matrix s2m(input, out.string());
+    s2m.loadHGNCDatabase(aHGNC);
+    s2m.process();
+  }
+  report(aName, Profile::now() - t0, aSamples, "samples", aBytes);
+}
+
+static bool
+wanted(const std::set<std::string>& aRun, const std::string& aName)
+{
+  return aRun.empty() || aRun.count(aName) != 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  std::string workdir, writeSOFT, writeHGNC, writeMatrix;
+  std::vector<std::string> only;
+  SyntheticSOFTShape shape;
+  uint32_t arrays = 2000, matrixGenes = 10000, lookups = 1000000;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("workdir", po::value<std::string>(&workdir),
+     "The directory to write the synthetic data into (default a new "
+     "temporary directory, removed afterwards)")
+    ("benchmark", po::value<std::vector<std::string> >(&only),
+     "Only run this benchmark; may be given more than once")
+    ("probesets", po::value<uint32_t>(&shape.mProbesets),
+     "The number of probesets on the synthetic platform (default 20000)")
+    ("samples", po::value<uint32_t>(&shape.mSamples),
+     "The number of samples in the synthetic SOFT file (default 200)")
+    ("genes", po::value<uint32_t>(&shape.mGenes),
+     "The number of genes in the synthetic HGNC table (default 10000)")
+    ("multi_gene_fraction", po::value<double>(&shape.mMultiGeneFraction),
+     "The fraction of probesets listing two symbols (default 0.2)")
+    ("missing_table_fraction", po::value<double>(&shape.mMissingTableFraction),
+     "The fraction of samples with no table (default 0.05)")
+    ("missing_value_fraction", po::value<double>(&shape.mMissingValueFraction),
+     "The fraction of values left out of a table or null (default 0.02)")
+    ("compression", po::value<std::string>(&shape.mCompression),
+     "Also time converting a copy compressed with 'gzip' or 'bzip2' "
+     "(default none)")
+    ("arrays", po::value<uint32_t>(&arrays),
+     "The number of arrays in the synthetic matrix (default 2000)")
+    ("matrix_genes", po::value<uint32_t>(&matrixGenes),
+     "The number of genes in the synthetic matrix (default 10000)")
+    ("lookups", po::value<uint32_t>(&lookups),
+     "The number of lookups to time for probeset IDs and HGNC names "
+     "(default 1000000)")
+    ("seed", po::value<uint64_t>(&shape.mSeed),
+     "The seed for the synthetic data (default 1)")
+    ("write_soft", po::value<std::string>(&writeSOFT),
+     "Only write a synthetic SOFT file to this path")
+    ("write_hgnc", po::value<std::string>(&writeHGNC),
+     "Only write a synthetic HGNC table to this path")
+    ("write_matrix", po::value<std::string>(&writeMatrix),
+     "Only write a synthetic matrix into this directory")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (shape.mProbesets == 0 || shape.mGenes == 0 || arrays == 0 ||
+      matrixGenes == 0)
+  {
+    std::cerr << "The synthetic data cannot be empty." << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    if (writeSOFT != "" || writeHGNC != "" || writeMatrix != "")
+    {
+      if (writeSOFT != "")
+        writeSyntheticSOFT(writeSOFT, shape);
+      if (writeHGNC != "")
+        writeSyntheticHGNC(writeHGNC, shape.mGenes);
+      if (writeMatrix != "")
+        writeSyntheticMatrix(writeMatrix, arrays, matrixGenes, 0.05,
+                             shape.mSeed);
+      return 0;
+    }
+
+    bool removeWorkdir = workdir == "";
+    fs::path dir = removeWorkdir ?
+      fs::temp_directory_path() / fs::unique_path("benchmark-%%%%-%%%%") :
+      fs::path(workdir);
+    ScopedRemoveDir removeDir(dir, removeWorkdir);
+    fs::create_directories(dir);
+
+    std::string hgnc = (dir / "hgnc").string();
+    std::string soft = (dir / "synthetic.soft").string();
+    std::string compressed;
+    fs::path matrix = dir / "matrix";
+
+    printf("Generating %u probesets x %u samples, %u HGNC genes and a "
+           "%u x %u matrix in %s\n", shape.mProbesets, shape.mSamples,
+           shape.mGenes, arrays, matrixGenes, dir.string().c_str());
+    writeSyntheticHGNC(hgnc, shape.mGenes);
+    std::string compression = shape.mCompression;
+    shape.mCompression = "none";
+    uint64_t softBytes = writeSyntheticSOFT(soft, shape);
+    if (compression != "none")
+    {
+      shape.mCompression = compression;
+      compressed = soft + (compression == "gzip" ? ".gz" : ".bz2");
+      writeSyntheticSOFT(compressed, shape);
+    }
+    writeSyntheticMatrix(matrix.string(), arrays, matrixGenes, 0.05,
+                         shape.mSeed);
+
+    std::set<std::string> run(only.begin(), only.end());
+    if (wanted(run, "parse_lines"))
+    {
+      benchParseLines("parse_lines", soft);
+      if (compressed != "")
+        benchParseLines("parse_lines_" + compression, compressed);
+    }
+    if (wanted(run, "probeset_lookup"))
+      benchProbesetLookup(shape.mProbesets, lookups, shape.mSeed);
+    if (wanted(run, "find_hgnc_id"))
+      SOFT2MatrixBenchmark::findHGNCId(dir, soft, hgnc, shape.mGenes,
+                                       lookups, shape.mSeed);
+    if (wanted(run, "sample_table_done"))
+      SOFT2MatrixBenchmark::sampleTableDone(dir, soft, hgnc, shape.mSamples,
+                                            shape.mSeed);
+    if (wanted(run, "rank_row"))
+      benchRankRows((matrix / "data").string(), arrays, matrixGenes);
+    if (wanted(run, "invert_data"))
+      benchInvertData(matrix, arrays, matrixGenes);
+    if (wanted(run, "rank_transform"))
+      benchRankTransform(matrix, arrays, matrixGenes);
+    if (wanted(run, "matrix_stats"))
+      benchMatrixStats(matrix, arrays, matrixGenes);
+    if (wanted(run, "soft2matrix"))
+    {
+      benchSOFT2Matrix("soft2matrix", dir, soft, hgnc, softBytes,
+                       shape.mSamples);
+      if (compressed != "")
+        benchSOFT2Matrix("soft2matrix_" + compression, dir, compressed, hgnc,
+                         softBytes, shape.mSamples);
+    }
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+    CheckHGNCLoader: Check the threaded HGNC loader against the serial one.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include "HGNCDatabase.hpp"
+#include "RuntimeException.hpp"
+#include "SyntheticData.hpp"
+#include <iostream>
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+// Checks what aDb gives for the names of the synthetic table's conflict
+// groups: an approved symbol overrides any earlier previous symbol, alias
+// or name, and otherwise the first of those wins; the last of several
+// approved symbols wins; and an id's first approved symbol is its name.
+// Returns the number of names it gets wrong.
+static uint32_t
+checkConflicts(const HGNCDatabase& aDb, uint32_t aGenes, const char* aLoader)
+{
+  struct Expected
+  {
+    const char* mSuffix;
+    uint32_t mRow;
+  };
+  static const Expected lookups[] = {
+    { "A", 0 }, { "PREV", 4 }, { "ALIAS", 0 }, { "ALIASB", 7 },
+    { "KEEP", 3 }, { "DUP", 5 }, { "FIRST", 2 }, { "SECOND", 2 },
+    { "B", 6 }
+  }, names[] = {
+    { "A", 0 }, { "DUP", 1 }, { "FIRST", 2 }, { "KEEP", 3 }, { "PREV", 4 },
+    { "DUP", 5 }, { "B", 6 }, { "ALIASB", 7 }
+  };
+
+  uint32_t wrong = 0;
+  for (uint32_t g = 0; g < kSyntheticHGNCConflicts; g++)
+  {
+    std::string prefix = "CONFLICT" + boost::lexical_cast<std::string>(g);
+    for (uint32_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++)
+    {
+      std::string name = prefix + lookups[i].mSuffix;
+      uint32_t want = syntheticConflictId(aGenes, g, lookups[i].mRow),
+        got = aDb.lookup(name);
+      if (got != want)
+      {
+        std::cerr << "The " << aLoader << " loader maps " << name << " to "
+                  << got << ", not " << want << "." << std::endl;
+        wrong++;
+      }
+    }
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+      uint32_t id = syntheticConflictId(aGenes, g, names[i].mRow);
+      std::string want = prefix + names[i].mSuffix;
+      if (aDb.approvedName(id) != want)
+      {
+        std::cerr << "The " << aLoader << " loader names " << id << " "
+                  << aDb.approvedName(id) << ", not " << want << "."
+                  << std::endl;
+        wrong++;
+      }
+    }
+  }
+  return wrong;
+}
+
+int
+main(int argc, char** argv)
+{
+  std::string hgnc;
+  uint32_t threads = 0, genes = 10000;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("hgnc", po::value<std::string>(&hgnc),
+     "File containing the HGNC names database (default a synthetic one)")
+    ("genes", po::value<uint32_t>(&genes),
+     "The number of genes in the synthetic HGNC table (default 10000)")
+    ("hgnc_threads", po::value<uint32_t>(&threads),
+     "The number of threads for the threaded loader (default 2, 3, 4 and "
+     "7 in turn)")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  bool removeHGNC = hgnc == "";
+  if (removeHGNC)
+    hgnc = (fs::temp_directory_path() /
+            fs::unique_path("hgnc-%%%%-%%%%")).string();
+
+  int status = 1;
+  try
+  {
+    if (removeHGNC)
+      writeSyntheticHGNC(hgnc, genes);
+
+    // The chunk boundaries move with the number of threads, so each
+    // conflict group is split across one at some of these counts and not
+    // at others.
+    std::vector<uint32_t> threadCounts;
+    if (threads != 0)
+      threadCounts.push_back(threads);
+    else
+    {
+      uint32_t counts[] = { 2, 3, 4, 7 };
+      threadCounts.assign(counts, counts + sizeof(counts) / sizeof(counts[0]));
+    }
+
+    HGNCDatabase serial;
+    serial.loadSerially(hgnc);
+    uint32_t wrong = removeHGNC ? checkConflicts(serial, genes, "serial") : 0;
+    for (uint32_t t = 0; t < threadCounts.size(); t++)
+    {
+      HGNCDatabase threaded;
+      threaded.load(hgnc, threadCounts[t]);
+      std::string loader = boost::lexical_cast<std::string>(threadCounts[t]) +
+        " thread";
+      if (!(threaded == serial))
+      {
+        std::cerr << "The " << loader << " loader does not match the serial "
+                  << "one." << std::endl;
+        wrong++;
+      }
+      if (removeHGNC)
+        wrong += checkConflicts(threaded, genes, loader.c_str());
+    }
+
+    if (wrong == 0)
+    {
+      std::cout << "The HGNC loaders agree." << std::endl;
+      status = 0;
+    }
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+  }
+
+  if (removeHGNC)
+    fs::remove(hgnc);
+  return status;
+}
@@ -0,0 +1,230 @@
+/*
+    CheckMatrixStats: Check merged statistics against a single pass.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+#include "MatrixStats.hpp"
+#include "RuntimeException.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+// The fields of MatrixStats::rowStats() and columnStats() before the
+// quantiles.
+static const uint32_t kRowFields = 6;
+
+// How far, as a fraction of the count, aEstimate's ranks among aSorted are
+// from the rank aQ asks for.
+static double
+rankError(const std::vector<double>& aSorted, double aQ, double aEstimate)
+{
+  double wanted = aQ * (aSorted.size() - 1);
+  double below = std::lower_bound(aSorted.begin(), aSorted.end(), aEstimate) -
+    aSorted.begin();
+  double upTo = std::upper_bound(aSorted.begin(), aSorted.end(), aEstimate) -
+    aSorted.begin() - 1.0;
+  if (wanted < below)
+    return (below - wanted) / aSorted.size();
+  if (wanted > upTo)
+    return (wanted - upTo) / aSorted.size();
+  return 0.0;
+}
+
+static bool
+nearlyEqual(double a, double b)
+{
+  if (std::isnan(a) || std::isnan(b))
+    return std::isnan(a) && std::isnan(b);
+  return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(a));
+}
+
+// Compares aMerged with aSingle, which saw the same rows in one pass: the
+// rows' statistics and the columns' counts and ranges must be the same,
+// their means and variances the same up to rounding, and the quantiles of
+// both within aBound of the right rank. Returns the number of differences.
+static uint32_t
+compare(const MatrixStats& aSingle, const MatrixStats& aMerged,
+        const std::vector<std::vector<double> >& aColumns,
+        const std::vector<double>& aQuantiles, double aBound,
+        double& aWorstError)
+{
+  uint32_t wrong = 0;
+  const std::vector<double>& rows1 = aSingle.rowStats(), & rows2 =
+    aMerged.rowStats();
+  if (rows1.size() != rows2.size() ||
+      memcmp(&rows1[0], &rows2[0], rows1.size() * sizeof(double)) != 0)
+  {
+    std::cerr << "The row statistics differ." << std::endl;
+    wrong++;
+  }
+
+  std::vector<double> cols1(aSingle.columnStats()),
+    cols2(aMerged.columnStats());
+  uint32_t stride = kRowFields + aQuantiles.size();
+  for (uint32_t c = 0; c < aColumns.size(); c++)
+  {
+    const double* s1 = &cols1[c * stride], * s2 = &cols2[c * stride];
+    bool same = true;
+    for (uint32_t i = 0; i < kRowFields; i++)
+      if (i == 2 || i == 3 ? !nearlyEqual(s1[i], s2[i]) :
+          memcmp(&s1[i], &s2[i], sizeof(double)) != 0)
+        same = false;
+    for (uint32_t q = 0; q < aQuantiles.size(); q++)
+    {
+      if (aColumns[c].empty())
+      {
+        same = same && std::isnan(s1[kRowFields + q]) &&
+          std::isnan(s2[kRowFields + q]);
+        continue;
+      }
+      double e1 = rankError(aColumns[c], aQuantiles[q], s1[kRowFields + q]),
+        e2 = rankError(aColumns[c], aQuantiles[q], s2[kRowFields + q]);
+      aWorstError = std::max(aWorstError, std::max(e1, e2));
+      if (e1 > aBound || e2 > aBound)
+        same = false;
+    }
+    if (!same)
+    {
+      std::cerr << "The statistics of column " << c << " differ."
+                << std::endl;
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+int
+main(int argc, char** argv)
+{
+  uint32_t rows = 20000, columns = 30, capacity = 32;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("rows", po::value<uint32_t>(&rows),
+     "The number of rows of the synthetic matrix (default 20000)")
+    ("columns", po::value<uint32_t>(&columns),
+     "The number of columns of the synthetic matrix (default 30)")
+    ("capacity", po::value<uint32_t>(&capacity),
+     "The sketch capacity (default 32)")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || columns < 2)
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  // Normal values with a few that are not finite, a column with nothing
+  // else, and a column that is sorted, which is the hardest order for a
+  // sketch.
+  boost::random::mt19937 rng(1);
+  boost::random::normal_distribution<double> normal;
+  boost::random::uniform_01<double> uniform;
+  std::vector<double> data(static_cast<uint64_t>(rows) * columns);
+  std::vector<std::vector<double> > sorted(columns);
+  for (uint32_t r = 0; r < rows; r++)
+    for (uint32_t c = 0; c < columns; c++)
+    {
+      double u = uniform(rng), x = c == 1 ? r : normal(rng) * (c + 1);
+      if (c == 0 || u < 0.03)
+        x = std::numeric_limits<double>::quiet_NaN();
+      else if (u < 0.04)
+        x = std::numeric_limits<double>::infinity();
+      data[static_cast<uint64_t>(r) * columns + c] = x;
+      if (std::isfinite(x))
+        sorted[c].push_back(x);
+    }
+  for (uint32_t c = 0; c < columns; c++)
+    std::sort(sorted[c].begin(), sorted[c].end());
+
+  // The sketch's rank error is about its number of levels over its
+  // capacity, and merged sketches are held to the same.
+  std::vector<double> quantiles(MatrixStats::defaultQuantiles());
+  double levels = std::log(static_cast<double>(rows) / capacity) /
+    std::log(2.0) + 2;
+  double bound = levels / capacity;
+
+  fs::path dir = fs::temp_directory_path() /
+    fs::unique_path("matrix-stats-%%%%-%%%%");
+  uint32_t wrong = 0;
+  double worst = 0.0;
+  try
+  {
+    fs::create_directory(dir);
+    MatrixStats single(columns, quantiles, capacity);
+    single.addRows(&data[0], rows);
+
+    // The rows are split into uneven parts, each gathered and saved on its
+    // own, as shards and appending runs do, then merged in order.
+    uint32_t partCounts[] = { 2, 3, 7 };
+    for (uint32_t p = 0; p < sizeof(partCounts) / sizeof(partCounts[0]); p++)
+    {
+      uint32_t parts = partCounts[p];
+      MatrixStats merged(columns, quantiles);
+      for (uint32_t i = 0; i < parts; i++)
+      {
+        uint32_t r0 = static_cast<uint64_t>(rows) * i * i / (parts * parts),
+          r1 = static_cast<uint64_t>(rows) * (i + 1) * (i + 1) /
+          (parts * parts);
+        MatrixStats part(columns, quantiles, capacity);
+        part.addRows(&data[static_cast<uint64_t>(r0) * columns], r1 - r0, 2);
+        std::string saved = (dir / MatrixStats::kSavedName).string();
+        part.save(saved);
+        merged.addSaved(saved);
+      }
+      uint32_t partsWrong = compare(single, merged, sorted, quantiles, bound,
+                                    worst);
+      if (partsWrong != 0)
+        std::cerr << "Merging " << parts << " parts gave different "
+                  << "statistics." << std::endl;
+      wrong += partsWrong;
+    }
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    wrong++;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    wrong++;
+  }
+
+  fs::remove_all(dir);
+  if (wrong != 0)
+    return 1;
+  std::cout << "The merged statistics agree; the worst quantile rank error "
+            << "was " << worst << " of the count, within " << bound << "."
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,37 @@
+# Checks that RankTransformDataset --qnorm gives the same bytes whether it
+# runs as one process or as shards. Run by ctest, with BENCHMARK, RANK and
+# WORKDIR set to the Benchmark and RankTransformDataset executables and a
+# scratch directory.
+
+FILE(REMOVE_RECURSE ${WORKDIR})
+FILE(MAKE_DIRECTORY ${WORKDIR})
+
+# 9000 rows are three rank sum blocks, the last of them partial.
+EXECUTE_PROCESS(COMMAND ${BENCHMARK} --write_matrix ${WORKDIR}/matrix
+  --arrays 9000 --matrix_genes 50 RESULT_VARIABLE rc)
+IF(NOT rc EQUAL 0)
+  MESSAGE(FATAL_ERROR "Cannot write the synthetic matrix.")
+ENDIF(NOT rc EQUAL 0)
+
+EXECUTE_PROCESS(COMMAND ${RANK} --matrixdir ${WORKDIR}/matrix --qnorm
+  --output ${WORKDIR}/single RESULT_VARIABLE rc OUTPUT_QUIET)
+IF(NOT rc EQUAL 0)
+  MESSAGE(FATAL_ERROR "The single process run failed.")
+ENDIF(NOT rc EQUAL 0)
+
+FOREACH(shards 2 3)
+  EXECUTE_PROCESS(COMMAND ${RANK} --matrixdir ${WORKDIR}/matrix --qnorm
+    --local_shards ${shards} --output ${WORKDIR}/sharded${shards}
+    RESULT_VARIABLE rc OUTPUT_QUIET)
+  IF(NOT rc EQUAL 0)
+    MESSAGE(FATAL_ERROR "The run with ${shards} shards failed.")
+  ENDIF(NOT rc EQUAL 0)
+  EXECUTE_PROCESS(COMMAND ${CMAKE_COMMAND} -E compare_files
+    ${WORKDIR}/single ${WORKDIR}/sharded${shards} RESULT_VARIABLE rc)
+  IF(NOT rc EQUAL 0)
+    MESSAGE(FATAL_ERROR
+      "${shards} shards do not match the single process output.")
+  ENDIF(NOT rc EQUAL 0)
+ENDFOREACH(shards)
+
+FILE(REMOVE_RECURSE ${WORKDIR})
@@ -0,0 +1,294 @@
+/*
+    HGNCDatabase: Map gene names onto HGNC ids.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "HGNCDatabase.hpp"
+#include "RuntimeException.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/regex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/tokenizer.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// The names found on part of the file, in the order they were found, with
+// enough kept about each to merge them with the other parts in file order.
+struct HGNCDatabase::Chunk
+{
+  StringArena mMappingNames, mNames;
+  // For each name, the id given by its first previous symbol, alias or
+  // name, and by its last approved symbol, or kNotFound.
+  std::vector<uint32_t> mFirstPlain, mLastOverride;
+  // Every approved symbol, as its HGNC id and its id in mNames.
+  std::vector<std::pair<uint32_t, uint32_t> > mApproved;
+
+  void
+  add(const std::string& aMapping, uint32_t aHGNC, bool aOverride)
+  {
+    if (aOverride)
+      mApproved.push_back(std::pair<uint32_t, uint32_t>
+                          (aHGNC, mNames.intern(aMapping)));
+
+    uint32_t i = mMappingNames.intern(cleanName(aMapping));
+    if (i == mFirstPlain.size())
+    {
+      mFirstPlain.push_back(StringArena::kNotFound);
+      mLastOverride.push_back(StringArena::kNotFound);
+    }
+    if (aOverride)
+      mLastOverride[i] = aHGNC;
+    else if (mFirstPlain[i] == StringArena::kNotFound)
+      mFirstPlain[i] = aHGNC;
+  }
+};
+
+// Passes each name on one line of the database to aTarget.add().
+template<typename Target>
+static void
+parseEntry(const std::string& aEntry, Target& aTarget)
+{
+  boost::tokenizer<boost::char_separator<char> >
+    tok(aEntry, boost::char_separator<char>("\t", "",
+                                            boost::keep_empty_tokens));
+  std::vector<std::string> v(tok.begin(), tok.end());
+
+  if (v.size() < 6)
+    return;
+
+  if (v[3] != "Approved")
+    return;
+
+  uint32_t hgncId = strtoul(v[0].c_str(), NULL, 10);
+  aTarget.add(v[1], hgncId, true);
+
+  static const boost::regex rtok("[, ]+");
+
+  aTarget.add(v[2], hgncId, false);
+
+  boost::sregex_token_iterator rti1
+    (make_regex_token_iterator(v[4], rtok, -1));
+  boost::sregex_token_iterator end;
+  for (; rti1 != end; rti1++)
+    aTarget.add(*rti1, hgncId, false);
+
+  boost::sregex_token_iterator rti2
+    (make_regex_token_iterator(v[5], rtok, -1));
+  for (; rti2 != end; rti2++)
+    aTarget.add(*rti2, hgncId, false);
+}
+
+void
+HGNCDatabase::parseChunk(const char* aBegin, const char* aEnd, Chunk* aChunk)
+{
+  std::string entry;
+  while (aBegin < aEnd)
+  {
+    const char* eol = std::find(aBegin, aEnd, '\n');
+    entry.assign(aBegin, eol);
+    parseEntry(entry, *aChunk);
+    aBegin = eol + 1;
+  }
+}
+
+HGNCDatabase::HGNCDatabase()
+{
+}
+
+HGNCDatabase::~HGNCDatabase()
+{
+}
+
+std::string
+HGNCDatabase::cleanName(const std::string& aName)
+{
+  std::string uc(boost::algorithm::to_upper_copy(aName));
+  boost::algorithm::replace_all(uc, "-", "");
+
+  return uc;
+}
+
+void
+HGNCDatabase::loadSerially(const std::string& aPath)
+{
+  std::ifstream db(aPath.c_str());
+  if (!db)
+    throw RuntimeException("Cannot open the HGNC database.");
+
+  // Skip the header...
+  std::string entry;
+  std::getline(db, entry);
+
+  while (db.good())
+  {
+    std::getline(db, entry);
+    parseEntry(entry, *this);
+  }
+}
+
+void
+HGNCDatabase::load(const std::string& aPath, uint32_t aThreads)
+{
+  std::ifstream db(aPath.c_str());
+  if (!db)
+    throw RuntimeException("Cannot open the HGNC database.");
+  std::ostringstream contents;
+  contents << db.rdbuf();
+  std::string text(contents.str());
+
+  // Skip the header...
+  const char* begin = text.data(), * end = text.data() + text.size();
+  begin = std::find(begin, end, '\n');
+  if (begin == end)
+    return;
+  begin++;
+
+  if (aThreads == 0)
+    aThreads = boost::thread::hardware_concurrency();
+  if (aThreads == 0)
+    aThreads = 1;
+
+  // Each chunk ends just after a newline, so no line is split.
+  std::vector<const char*> bounds(1, begin);
+  for (uint32_t c = 1; c < aThreads; c++)
+  {
+    const char* b = begin + (end - begin) * static_cast<uint64_t>(c) /
+      aThreads;
+    if (b < bounds.back())
+      b = bounds.back();
+    b = std::find(b, end, '\n');
+    bounds.push_back(b == end ? end : b + 1);
+  }
+  bounds.push_back(end);
+
+  std::vector<Chunk*> chunks;
+  boost::thread_group parsers;
+  for (uint32_t c = 0; c < aThreads; c++)
+  {
+    chunks.push_back(new Chunk());
+    parsers.create_thread(boost::bind(&HGNCDatabase::parseChunk, bounds[c],
+                                      bounds[c + 1], chunks[c]));
+  }
+  parsers.join_all();
+
+  // Names already loaded count as claimed, just as they would for another
+  // line of the file.
+  std::vector<uint32_t> firstPlain(mIdMappings),
+    lastOverride(mIdMappings.size(), StringArena::kNotFound);
+  for (uint32_t c = 0; c < aThreads; c++)
+  {
+    merge(*chunks[c], firstPlain, lastOverride);
+    delete chunks[c];
+  }
+
+  mIdMappings.resize(firstPlain.size());
+  for (uint32_t i = 0; i < firstPlain.size(); i++)
+    mIdMappings[i] = lastOverride[i] != StringArena::kNotFound ?
+      lastOverride[i] : firstPlain[i];
+}
+
+void
+HGNCDatabase::merge(const Chunk& aChunk, std::vector<uint32_t>& aFirstPlain,
+                    std::vector<uint32_t>& aLastOverride)
+{
+  for (std::vector<std::pair<uint32_t, uint32_t> >::const_iterator i =
+         aChunk.mApproved.begin(); i != aChunk.mApproved.end(); i++)
+    setName(i->first, aChunk.mNames.str(i->second));
+
+  for (uint32_t i = 0; i < aChunk.mMappingNames.size(); i++)
+  {
+    uint32_t g = mMappingNames.intern(aChunk.mMappingNames.str(i));
+    if (g == aFirstPlain.size())
+    {
+      aFirstPlain.push_back(StringArena::kNotFound);
+      aLastOverride.push_back(StringArena::kNotFound);
+    }
+    if (aChunk.mLastOverride[i] != StringArena::kNotFound)
+      aLastOverride[g] = aChunk.mLastOverride[i];
+    if (aFirstPlain[g] == StringArena::kNotFound)
+      aFirstPlain[g] = aChunk.mFirstPlain[i];
+  }
+}
+
+void
+HGNCDatabase::add(const std::string& aMapping, uint32_t aHGNC,
+                  bool aOverride)
+{
+  if (aOverride)
+    setName(aHGNC, aMapping);
+
+  uint32_t i = mMappingNames.intern(cleanName(aMapping));
+  if (i == mIdMappings.size())
+    mIdMappings.push_back(aHGNC);
+  else if (aOverride)
+    mIdMappings[i] = aHGNC;
+}
+
+// Only the first approved symbol for an id is kept.
+void
+HGNCDatabase::setName(uint32_t aHGNC, boost::string_ref aName)
+{
+  if (aHGNC >= mNameByHGNCId.size())
+    mNameByHGNCId.resize(aHGNC + 1, StringArena::kNotFound);
+  if (mNameByHGNCId[aHGNC] == StringArena::kNotFound)
+    mNameByHGNCId[aHGNC] = mNames.intern(aName);
+}
+
+uint32_t
+HGNCDatabase::lookup(boost::string_ref aName) const
+{
+  uint32_t i = mMappingNames.find(aName);
+  if (i == StringArena::kNotFound)
+    return 0;
+  return mIdMappings[i];
+}
+
+boost::string_ref
+HGNCDatabase::approvedName(uint32_t aHGNC) const
+{
+  if (aHGNC >= mNameByHGNCId.size() ||
+      mNameByHGNCId[aHGNC] == StringArena::kNotFound)
+    return boost::string_ref();
+  return mNames.str(mNameByHGNCId[aHGNC]);
+}
+
+bool
+HGNCDatabase::operator==(const HGNCDatabase& aOther) const
+{
+  if (mMappingNames.size() != aOther.mMappingNames.size())
+    return false;
+  for (uint32_t i = 0; i < mMappingNames.size(); i++)
+    if (mMappingNames.str(i) != aOther.mMappingNames.str(i) ||
+        mIdMappings[i] != aOther.mIdMappings[i])
+      return false;
+
+  uint32_t ids = std::max(mNameByHGNCId.size(), aOther.mNameByHGNCId.size());
+  for (uint32_t h = 0; h < ids; h++)
+    if (approvedName(h) != aOther.approvedName(h))
+      return false;
+  return true;
+}
+
+void
+HGNCDatabase::clear()
+{
+  mMappingNames.clear();
+  mNames.clear();
+  std::vector<uint32_t>().swap(mIdMappings);
+  std::vector<uint32_t>().swap(mNameByHGNCId);
+}
@@ -0,0 +1,86 @@
+/*
+    HGNCDatabase: Map gene names onto HGNC ids.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef HGNC_DATABASE_HPP
+#define HGNC_DATABASE_HPP
+
+#include <boost/utility/string_ref.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "StringArena.hpp"
+
+// The names from the HGNC database, cleaned up (upper case, without dashes),
+// with the HGNC id each one maps to, and the approved symbol for each id.
+//
+// An approved symbol maps to its id whatever came before it in the file,
+// while previous symbols, aliases and names only claim a name that nothing
+// has claimed yet. When one approved symbol is given to more than one id,
+// the last one wins; when one id is given more than one approved symbol,
+// the first one is its name.
+class HGNCDatabase
+{
+public:
+  HGNCDatabase();
+  ~HGNCDatabase();
+
+  // Reads the database, splitting the file into line-aligned chunks that
+  // are parsed on aThreads threads (0 for one per processor) and then
+  // merged in file order, so the result is the same as loadSerially()'s.
+  void load(const std::string& aPath, uint32_t aThreads = 0);
+
+  // Reads the database a line at a time on this thread.
+  void loadSerially(const std::string& aPath);
+
+  // The HGNC id that a cleaned up name maps to, or 0.
+  uint32_t lookup(boost::string_ref aName) const;
+
+  // The approved symbol for an HGNC id, or an empty string.
+  boost::string_ref approvedName(uint32_t aHGNC) const;
+
+  static std::string cleanName(const std::string& aName);
+
+  // Whether both databases map the same names, in the same order, to the
+  // same ids, and give every id the same name.
+  bool operator==(const HGNCDatabase& aOther) const;
+
+  // Frees everything at once.
+  void clear();
+
+  // Adds one name for an HGNC id, as read from the database.
+  void add(const std::string& aMapping, uint32_t aHGNC, bool aOverride);
+
+private:
+  struct Chunk;
+
+  // mIdMappings is indexed by the name's id in mMappingNames, and
+  // mNameByHGNCId holds the id in mNames of each HGNC id's approved
+  // symbol, or kNotFound.
+  StringArena mMappingNames, mNames;
+  std::vector<uint32_t> mIdMappings, mNameByHGNCId;
+
+  HGNCDatabase(const HGNCDatabase&);
+  HGNCDatabase& operator=(const HGNCDatabase&);
+
+  static void parseChunk(const char* aBegin, const char* aEnd,
+                         Chunk* aChunk);
+  void setName(uint32_t aHGNC, boost::string_ref aName);
+  void merge(const Chunk& aChunk, std::vector<uint32_t>& aFirstPlain,
+             std::vector<uint32_t>& aLastOverride);
+};
+
+#endif // HGNC_DATABASE_HPP
@@ -17,6 +17,13 @@
 */
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include "Matrix.hpp"
+#include "Profile.hpp"
+#include "RowReader.hpp"
+#include "Shard.hpp"
+#include "TransposeWriter.hpp"
+#include "RuntimeException.hpp"
 #include <iostream>
 #include <fstream>
 #include <cstdio>
@@ -24,115 +31,114 @@
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-class RuntimeException
-{
-public:
-  RuntimeException(const char* aWhy)
-    : mWhy(aWhy)
-  {
-  }
-
-  const std::string what()
-  {
-    return mWhy;
-  }
-
-private:
-  const char* mWhy;
-};
-
 class DataInverter
 {
 public:
-  DataInverter(const std::string& aMatrixDir)
-    : mMatrixDir(aMatrixDir), mnArrays(0), mnGenes(0)
+  DataInverter(const std::string& aMatrixDir, bool aUpdate = false,
+               const Shard& aShard = Shard())
+    : mMatrixDir(aMatrixDir), mnArrays(0), mnGenes(0),
+      mArraysInverted(Profile::counter("arrays_inverted"))
   {
     fs::path arrayList(mMatrixDir);
     arrayList /= "arrays";
-    {
-      std::ifstream as(arrayList.string().c_str());
-      while (as.good())
-      {
-        std::string l;
-        std::getline(as, l);
-        if (!as.good())
-          break;
-        mnArrays++;
-      }
-    }
+    mnArrays = countLabels(arrayList.string());
 
     fs::path geneList(mMatrixDir);
     geneList /= "genes";
-    {
-      std::ifstream gs(geneList.string().c_str());
-      while (gs.good())
-      {
-        std::string l;
-        std::getline(gs, l);
-        if (!gs.good())
-          break;
-        mnGenes++;
-      }
-    }
+    mnGenes = countLabels(geneList.string());
 
     fs::path data(mMatrixDir);
     data /= "data";
 
     fs::path invdata(mMatrixDir);
     invdata /= "inverse_data";
-    FILE* dataf = fopen(data.string().c_str(), "r");
-    FILE* invdataf = fopen(invdata.string().c_str(), "w");
 
-    double* bigbuf = new double[mnGenes * kConcurrentRows];
-    double* smallbuf = new double[kConcurrentRows];
-    uint32_t row0 = 0;
-    while (row0 < mnArrays)
+    // A shard only transposes its own range of arrays, writing them into
+    // their place in inverse_data. Otherwise the new inverse_data is
+    // written under another name, and only renamed into place once it is
+    // complete, so that an interrupted run never leaves a full-sized
+    // inverse_data that --update would take to be finished.
+    uint64_t first, end;
+    aShard.rowRange(mnArrays, kConcurrentRows, first, end);
+    uint32_t row0 = first, rowEnd = end;
+    fs::path output(invdata);
+    if (aShard.whole())
+      output = invdata.string() + ".partial";
+
+    // When updating, only the arrays that have been appended to data since
+    // inverse_data was written are transposed; the existing rows of
+    // inverse_data are spread out into the new file to make room for them.
+    bool updating = false;
+    if (aUpdate && fs::exists(invdata) && mnGenes != 0)
     {
-      uint32_t rownext = row0 + kConcurrentRows;
-      if (rownext > mnArrays)
-        rownext = mnArrays;
-      if (fread(bigbuf, (rownext - row0) * mnGenes, sizeof(double), dataf) != sizeof(double))
-      {
-        delete [] bigbuf;
-        delete [] smallbuf;
-        throw RuntimeException("data file is truncated.");
-      }
+      uint64_t rowBytes = static_cast<uint64_t>(mnGenes) * sizeof(double);
+      uint64_t size = fs::file_size(invdata);
+      row0 = size / rowBytes;
+      if (size % rowBytes != 0 || row0 > mnArrays)
+        throw RuntimeException("inverse_data does not match the matrix; "
+                               "it needs to be rebuilt.");
+      if (row0 == mnArrays)
+        return;
+      updating = true;
+    }
+
+    // The next band of rows is read in the background while this one is
+    // being written out. The data is checked before anything is written.
+    RowReader dataf(data.string(), mnGenes, kConcurrentRows, 2, row0, rowEnd);
+    if (dataf.rowCount() < rowEnd - row0)
+      throw RuntimeException("data file is truncated.");
 
-      fseek(invdataf, row0 * sizeof(double), SEEK_SET);
- 
-      for (uint32_t col = 0; col < mnGenes; col++)
+    if (updating)
+      TransposeWriter::widen(invdata.string(), output.string(), mnGenes, row0,
+                             mnArrays);
+    {
+      TransposeWriter invdataf(output.string(), mnArrays, mnGenes,
+                               kConcurrentRows, row0, rowEnd);
+
+      while (row0 < rowEnd)
       {
-        const double* p = bigbuf + col;
-        for (uint32_t i = 0; i < (rownext - row0); i++)
-          smallbuf[i] = p[mnGenes * i];
-        fwrite(smallbuf, (rownext - row0), sizeof(double), invdataf);
-        fseek(invdataf, (mnArrays - rownext + row0) * sizeof(double), SEEK_CUR);
+        uint32_t nrows;
+        const double* bigbuf = dataf.nextBlock(nrows);
+        if (nrows > rowEnd - row0)
+          nrows = rowEnd - row0;
+        mArraysInverted.add(nrows);
+        invdataf.addRows(bigbuf, nrows);
+        row0 += nrows;
       }
-
-      row0 = rownext;
+      invdataf.finish();
     }
 
-    delete [] bigbuf;
-    delete [] smallbuf;
+    if (output != invdata)
+      fs::rename(output, invdata);
   }
 
 private:
   static const uint32_t kConcurrentRows = 3000;
   std::string mMatrixDir;
   uint32_t mnArrays, mnGenes;
+  ProfileCounter& mArraysInverted;
 };
 
 int
 main(int argc, char**argv)
 {
-  std::string matrixdir;
+  std::string matrixdir, shard, profile;
+  uint32_t localShards = 0, progress = 0;
   po::options_description desc;
 
   desc.add_options()
     ("matrixdir", po::value<std::string>(&matrixdir),
      "write matrix into directory")
+    ("update", "Only add the arrays appended to data since inverse_data was "
+     "last written")
+    ("shard", po::value<std::string>(&shard),
+     "Only transpose shard i of N of the arrays, given as i/N, into its "
+     "place in inverse_data")
+    ("local_shards", po::value<uint32_t>(&localShards),
+     "Run this many shards at once on this machine")
     ("help", "produce help message")
     ;
+  desc.add(Profile::options(profile, progress));
 
   po::variables_map vm;
 
@@ -160,12 +166,44 @@ main(int argc, char**argv)
     return 1;
   }
 
+  if (vm.count("update") && (vm.count("shard") || vm.count("local_shards")))
+  {
+    std::cerr << "--update cannot be used with shards" << std::endl;
+    return 1;
+  }
+
+  if (localShards > 1)
+    return runLocalShards(argc, argv, localShards) ? 0 : 1;
+
+  // Each shard reports on itself, into a file of its own.
+  std::string tool("InvertData");
+  if (vm.count("shard"))
+  {
+    tool += " " + shard;
+    if (profile != "")
+      profile += "." + boost::lexical_cast<std::string>(Shard(shard).index());
+  }
+  if (profile != "")
+    Profile::enable();
+  ScopedProgress progressLine(tool, progress);
+
   try
   {
-    DataInverter di(matrixdir);
+    {
+      DataInverter di(matrixdir, vm.count("update") != 0,
+                      vm.count("shard") ? Shard(shard) : Shard());
+    }
+    if (profile != "")
+      Profile::writeReport(profile, tool);
   }
   catch (std::exception& e)
   {
     std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
   }
 }
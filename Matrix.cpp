@@ -0,0 +1,146 @@
+/*
+    Matrix: Zero-copy access to a matrix directory written by SOFT2Matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Matrix.hpp"
+#include "RuntimeException.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = boost::filesystem;
+
+uint32_t
+countLabels(const std::string& aPath)
+{
+  uint32_t n = 0;
+  std::ifstream ls(aPath.c_str());
+  while (ls.good())
+  {
+    std::string l;
+    std::getline(ls, l);
+    if (!ls.good())
+      break;
+    n++;
+  }
+  return n;
+}
+
+void
+readLabels(const std::string& aPath, std::vector<std::string>& aLabels)
+{
+  std::ifstream ls(aPath.c_str());
+  while (ls.good())
+  {
+    std::string l;
+    std::getline(ls, l);
+    if (!ls.good())
+      break;
+    aLabels.push_back(l);
+  }
+}
+
+void
+LabelIndex::load(const std::string& aPath)
+{
+  mLabels.clear();
+  mIndex.clear();
+  readLabels(aPath, mLabels);
+
+  mIndex.rehash(mLabels.size());
+  for (uint32_t i = 0; i < mLabels.size(); i++)
+    mIndex.insert(index_t::value_type(mLabels[i], i));
+}
+
+uint32_t
+LabelIndex::find(const std::string& aName) const
+{
+  index_t::const_iterator i(mIndex.find(aName));
+  if (i == mIndex.end())
+    return kNotFound;
+  return (*i).second;
+}
+
+Matrix::Matrix(const std::string& aMatrixDir, Layout aLayout,
+               const std::string& aDataFile)
+  : mLayout(aLayout), mnRows(0), mnColumns(0), mData(NULL), mMapping(NULL),
+    mMappingSize(0)
+{
+  fs::path genes(aMatrixDir);
+  genes /= "genes";
+  mGenes.load(genes.string());
+
+  fs::path arrays(aMatrixDir);
+  arrays /= "arrays";
+  mArrays.load(arrays.string());
+
+  fs::path data(aMatrixDir);
+  if (mLayout == kInverseData)
+  {
+    data /= "inverse_data";
+    mnRows = mGenes.size();
+    mnColumns = mArrays.size();
+  }
+  else
+  {
+    data /= "data";
+    mnRows = mArrays.size();
+    mnColumns = mGenes.size();
+  }
+
+  if (aDataFile != "")
+    data = aDataFile;
+
+  mMappingSize = static_cast<uint64_t>(mnRows) * mnColumns * sizeof(double);
+  if (mMappingSize == 0)
+    return;
+
+  int fd = open(data.string().c_str(), O_RDONLY);
+  if (fd < 0)
+    throw RuntimeException("Cannot open the matrix data file.");
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < mMappingSize)
+  {
+    close(fd);
+    throw RuntimeException("The matrix data file is truncated.");
+  }
+
+  mMapping = mmap(NULL, mMappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mMapping == MAP_FAILED)
+  {
+    mMapping = NULL;
+    throw RuntimeException("Cannot map the matrix data file.");
+  }
+  mData = static_cast<const double*>(mMapping);
+}
+
+Matrix::~Matrix()
+{
+  if (mMapping != NULL)
+    munmap(mMapping, mMappingSize);
+}
+
+void
+Matrix::advise(int aAdvice) const
+{
+  if (mMapping != NULL)
+    madvise(mMapping, mMappingSize, aAdvice);
+}
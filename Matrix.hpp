@@ -0,0 +1,235 @@
+/*
+    Matrix: Zero-copy access to a matrix directory written by SOFT2Matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+#include <boost/unordered_map.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Counts the lines in a label file (genes or arrays).
+uint32_t countLabels(const std::string& aPath);
+
+// Reads the lines of a label file into aLabels.
+void readLabels(const std::string& aPath, std::vector<std::string>& aLabels);
+
+// The labels from a genes or arrays file, with a hash index to find a label's
+// position by name.
+class LabelIndex
+{
+public:
+  static const uint32_t kNotFound = 0xFFFFFFFFu;
+
+  LabelIndex()
+  {
+  }
+
+  LabelIndex(const std::string& aPath)
+  {
+    load(aPath);
+  }
+
+  void load(const std::string& aPath);
+
+  // The index of a label, or kNotFound.
+  uint32_t find(const std::string& aName) const;
+
+  const std::vector<std::string>&
+  labels() const
+  {
+    return mLabels;
+  }
+
+  uint32_t
+  size() const
+  {
+    return mLabels.size();
+  }
+
+private:
+  typedef boost::unordered_map<std::string, uint32_t> index_t;
+
+  std::vector<std::string> mLabels;
+  index_t mIndex;
+};
+
+// A contiguous run of values, such as one row of a matrix.
+struct RowSpan
+{
+  RowSpan(const double* aData, uint32_t aSize)
+    : mData(aData), mSize(aSize)
+  {
+  }
+
+  const double&
+  operator[](uint32_t aIndex) const
+  {
+    return mData[aIndex];
+  }
+
+  const double*
+  begin() const
+  {
+    return mData;
+  }
+
+  const double*
+  end() const
+  {
+    return mData + mSize;
+  }
+
+  uint32_t
+  size() const
+  {
+    return mSize;
+  }
+
+  const double* mData;
+  uint32_t mSize;
+};
+
+// Values spaced evenly apart, such as one column of a matrix.
+struct ColumnSpan
+{
+  ColumnSpan(const double* aData, uint32_t aSize, uint64_t aStride)
+    : mData(aData), mSize(aSize), mStride(aStride)
+  {
+  }
+
+  const double&
+  operator[](uint32_t aIndex) const
+  {
+    return mData[aIndex * mStride];
+  }
+
+  uint32_t
+  size() const
+  {
+    return mSize;
+  }
+
+  const double* mData;
+  uint32_t mSize;
+  uint64_t mStride;
+};
+
+// A read-only view of the data (or inverse_data) file in a matrix directory,
+// mapped into memory. Rows and columns are handed out as spans into the
+// mapping, so nothing is copied, and every process looking at the same
+// matrix shares the same pages of the page cache.
+//
+// For data, rows are arrays and columns are genes; for inverse_data it is the
+// other way around. The dimensions come from the genes and arrays files.
+// Files laid out like one of these, such as the output of
+// RankTransformDataset, can be viewed by naming them as aDataFile.
+class Matrix
+{
+public:
+  enum Layout
+  {
+    kData,
+    kInverseData
+  };
+
+  static const uint32_t kNotFound = LabelIndex::kNotFound;
+
+  Matrix(const std::string& aMatrixDir, Layout aLayout = kData,
+         const std::string& aDataFile = "");
+  ~Matrix();
+
+  Layout
+  layout() const
+  {
+    return mLayout;
+  }
+
+  uint32_t
+  rows() const
+  {
+    return mnRows;
+  }
+
+  uint32_t
+  columns() const
+  {
+    return mnColumns;
+  }
+
+  RowSpan
+  row(uint32_t aRow) const
+  {
+    return RowSpan(mData + static_cast<uint64_t>(aRow) * mnColumns,
+                   mnColumns);
+  }
+
+  ColumnSpan
+  column(uint32_t aColumn) const
+  {
+    return ColumnSpan(mData + aColumn, mnRows, mnColumns);
+  }
+
+  double
+  at(uint32_t aRow, uint32_t aColumn) const
+  {
+    return mData[static_cast<uint64_t>(aRow) * mnColumns + aColumn];
+  }
+
+  const std::vector<std::string>&
+  genes() const
+  {
+    return mGenes.labels();
+  }
+
+  const std::vector<std::string>&
+  arrays() const
+  {
+    return mArrays.labels();
+  }
+
+  // The index of a gene or array by name, or kNotFound.
+  uint32_t
+  geneIndex(const std::string& aName) const
+  {
+    return mGenes.find(aName);
+  }
+
+  uint32_t
+  arrayIndex(const std::string& aName) const
+  {
+    return mArrays.find(aName);
+  }
+
+  // Tells the kernel how the mapping is about to be used (an madvise
+  // advice value such as MADV_SEQUENTIAL or MADV_RANDOM).
+  void advise(int aAdvice) const;
+
+private:
+  Layout mLayout;
+  uint32_t mnRows, mnColumns;
+  LabelIndex mGenes, mArrays;
+  const double* mData;
+  void* mMapping;
+  uint64_t mMappingSize;
+
+  Matrix(const Matrix&);
+  Matrix& operator=(const Matrix&);
+};
+
+#endif // MATRIX_HPP
@@ -0,0 +1,323 @@
+/*
+    MatrixQuery: Random access to single genes, arrays or blocks of a matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "MatrixQuery.hpp"
+#include "RowReader.hpp"
+#include "RuntimeException.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace fs = boost::filesystem;
+
+// tiled_data starts with this header, padded out to kTiledHeaderBytes so that
+// the tiles after it are page aligned. Tiles follow in row-major order of
+// tiles, each holding its values row-major, with NaNs past the edges of the
+// matrix. The size and modification time of the data file the tiles were
+// built from are kept, so that tiles left behind by a rebuilt data file are
+// noticed even when its shape has not changed.
+struct TiledHeader
+{
+  char mMagic[8];
+  uint32_t mTileSize, mRows, mColumns;
+  uint64_t mDataSize;
+  int64_t mDataMtime;
+};
+static const char kTiledMagic[8] = { 'S', '2', 'M', 'T', 'I', 'L', 'E', '2' };
+static const uint32_t kTiledHeaderBytes = 4096;
+
+MatrixQuery::MatrixQuery(const std::string& aMatrixDir, uint32_t aCacheTiles)
+  : mData(NULL), mInverseData(NULL), mTiledFd(-1), mTileSize(0),
+    mTileColumns(0), mCacheTiles(aCacheTiles)
+{
+  fs::path genes(aMatrixDir);
+  genes /= "genes";
+  mGenes.load(genes.string());
+
+  fs::path arrays(aMatrixDir);
+  arrays /= "arrays";
+  mArrays.load(arrays.string());
+
+  if (mCacheTiles == 0)
+    mCacheTiles = 1;
+
+  fs::path data(aMatrixDir);
+  data /= "data";
+
+  fs::path tiled(aMatrixDir);
+  tiled /= "tiled_data";
+  if (fs::exists(tiled))
+  {
+    mTiledFd = open(tiled.string().c_str(), O_RDONLY);
+    TiledHeader h;
+    bool ok = mTiledFd >= 0 &&
+      pread(mTiledFd, &h, sizeof(h), 0) == sizeof(h) &&
+      memcmp(h.mMagic, kTiledMagic, sizeof(kTiledMagic)) == 0 &&
+      h.mRows == mArrays.size() && h.mColumns == mGenes.size() &&
+      h.mTileSize != 0;
+    // Without a data file there is nothing newer the tiles could be behind.
+    if (ok && fs::exists(data))
+      ok = h.mDataSize == fs::file_size(data) &&
+        h.mDataMtime == static_cast<int64_t>(fs::last_write_time(data));
+    if (ok)
+    {
+      mTileSize = h.mTileSize;
+      mTileColumns = (h.mColumns + mTileSize - 1) / mTileSize;
+      posix_fadvise(mTiledFd, 0, 0, POSIX_FADV_RANDOM);
+    }
+    else
+    {
+      std::cerr << "Warning: tiled_data is corrupt or out of date, and will "
+                << "not be used." << std::endl;
+      if (mTiledFd >= 0)
+        close(mTiledFd);
+      mTiledFd = -1;
+    }
+  }
+
+  if (fs::exists(data))
+  {
+    mData = new Matrix(aMatrixDir, Matrix::kData);
+    mData->advise(MADV_RANDOM);
+  }
+
+  fs::path invdata(aMatrixDir);
+  invdata /= "inverse_data";
+  if (fs::exists(invdata))
+  {
+    mInverseData = new Matrix(aMatrixDir, Matrix::kInverseData);
+    mInverseData->advise(MADV_RANDOM);
+  }
+
+  if (mTiledFd < 0 && mData == NULL && mInverseData == NULL)
+    throw RuntimeException("The matrix directory has no data files.");
+}
+
+MatrixQuery::~MatrixQuery()
+{
+  for (lru_t::iterator i = mTileCache.begin(); i != mTileCache.end(); i++)
+    delete [] (*i).mValues;
+  if (mTiledFd >= 0)
+    close(mTiledFd);
+  if (mData != NULL)
+    delete mData;
+  if (mInverseData != NULL)
+    delete mInverseData;
+}
+
+void
+MatrixQuery::buildTiles(const std::string& aMatrixDir, uint32_t aTileSize)
+{
+  fs::path genes(aMatrixDir);
+  genes /= "genes";
+  uint32_t nGenes = countLabels(genes.string());
+
+  fs::path arrays(aMatrixDir);
+  arrays /= "arrays";
+  uint32_t nArrays = countLabels(arrays.string());
+
+  fs::path data(aMatrixDir);
+  data /= "data";
+  RowReader rr(data.string(), nGenes, aTileSize);
+  if (rr.rowCount() < nArrays)
+    throw RuntimeException("data file is truncated.");
+
+  fs::path tiled(aMatrixDir);
+  tiled /= "tiled_data";
+  FILE* out = fopen(tiled.string().c_str(), "w");
+  if (out == NULL)
+    throw RuntimeException("Cannot open tiled_data.");
+
+  char header[kTiledHeaderBytes];
+  memset(header, 0, sizeof(header));
+  TiledHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.mMagic, kTiledMagic, sizeof(kTiledMagic));
+  h.mTileSize = aTileSize;
+  h.mRows = nArrays;
+  h.mColumns = nGenes;
+  h.mDataSize = fs::file_size(data);
+  h.mDataMtime = fs::last_write_time(data);
+  memcpy(header, &h, sizeof(h));
+  fwrite(header, sizeof(header), 1, out);
+
+  uint32_t tileColumns = (nGenes + aTileSize - 1) / aTileSize;
+  std::vector<double> t(static_cast<uint64_t>(aTileSize) * aTileSize);
+  for (uint32_t row0 = 0; row0 < nArrays; row0 += aTileSize)
+  {
+    uint32_t rows;
+    const double* band = rr.nextBlock(rows);
+    if (rows > nArrays - row0)
+      rows = nArrays - row0;
+
+    for (uint32_t tc = 0; tc < tileColumns; tc++)
+    {
+      std::fill(t.begin(), t.end(), std::numeric_limits<double>::quiet_NaN());
+      uint32_t col0 = tc * aTileSize;
+      uint32_t cols = std::min(aTileSize, nGenes - col0);
+      for (uint32_t i = 0; i < rows; i++)
+        memcpy(&t[static_cast<uint64_t>(i) * aTileSize],
+               band + static_cast<uint64_t>(i) * nGenes + col0,
+               cols * sizeof(double));
+      if (fwrite(&t[0], sizeof(double), t.size(), out) != t.size())
+      {
+        fclose(out);
+        throw RuntimeException("Failed to write tiled_data.");
+      }
+    }
+  }
+
+  fclose(out);
+}
+
+void
+MatrixQuery::geneProfile(uint32_t aGene, std::vector<double>& aValues)
+{
+  if (aGene >= mGenes.size())
+    throw RuntimeException("Gene is out of range.");
+
+  if (mInverseData != NULL)
+  {
+    RowSpan r(mInverseData->row(aGene));
+    aValues.assign(r.begin(), r.end());
+  }
+  else if (mTiledFd >= 0)
+    blockFromTiles(0, mArrays.size(), aGene, aGene + 1, aValues);
+  else
+  {
+    ColumnSpan c(mData->column(aGene));
+    aValues.resize(c.size());
+    for (uint32_t i = 0; i < c.size(); i++)
+      aValues[i] = c[i];
+  }
+}
+
+void
+MatrixQuery::arrayProfile(uint32_t aArray, std::vector<double>& aValues)
+{
+  if (aArray >= mArrays.size())
+    throw RuntimeException("Array is out of range.");
+
+  if (mData != NULL)
+  {
+    RowSpan r(mData->row(aArray));
+    aValues.assign(r.begin(), r.end());
+  }
+  else if (mTiledFd >= 0)
+    blockFromTiles(aArray, aArray + 1, 0, mGenes.size(), aValues);
+  else
+  {
+    ColumnSpan c(mInverseData->column(aArray));
+    aValues.resize(c.size());
+    for (uint32_t i = 0; i < c.size(); i++)
+      aValues[i] = c[i];
+  }
+}
+
+void
+MatrixQuery::block(uint32_t aArray0, uint32_t aArray1, uint32_t aGene0,
+                   uint32_t aGene1, std::vector<double>& aValues)
+{
+  if (aArray1 > mArrays.size() || aGene1 > mGenes.size() ||
+      aArray0 > aArray1 || aGene0 > aGene1)
+    throw RuntimeException("Block is out of range.");
+
+  if (mTiledFd >= 0)
+  {
+    blockFromTiles(aArray0, aArray1, aGene0, aGene1, aValues);
+    return;
+  }
+
+  uint32_t width = aGene1 - aGene0;
+  aValues.resize(static_cast<uint64_t>(aArray1 - aArray0) * width);
+  for (uint32_t a = aArray0; a < aArray1; a++)
+    for (uint32_t g = aGene0; g < aGene1; g++)
+      aValues[static_cast<uint64_t>(a - aArray0) * width + (g - aGene0)] =
+        mData != NULL ? mData->at(a, g) : mInverseData->at(g, a);
+}
+
+void
+MatrixQuery::blockFromTiles(uint32_t aArray0, uint32_t aArray1,
+                            uint32_t aGene0, uint32_t aGene1,
+                            std::vector<double>& aValues)
+{
+  uint32_t width = aGene1 - aGene0;
+  aValues.resize(static_cast<uint64_t>(aArray1 - aArray0) * width);
+  if (aArray0 == aArray1 || aGene0 == aGene1)
+    return;
+
+  for (uint32_t tr = aArray0 / mTileSize; tr <= (aArray1 - 1) / mTileSize;
+       tr++)
+    for (uint32_t tc = aGene0 / mTileSize; tc <= (aGene1 - 1) / mTileSize;
+         tc++)
+    {
+      const double* t = tile(tr, tc);
+      uint32_t a0 = std::max(aArray0, tr * mTileSize);
+      uint32_t a1 = std::min(aArray1, (tr + 1) * mTileSize);
+      uint32_t g0 = std::max(aGene0, tc * mTileSize);
+      uint32_t g1 = std::min(aGene1, (tc + 1) * mTileSize);
+      for (uint32_t a = a0; a < a1; a++)
+        memcpy(&aValues[static_cast<uint64_t>(a - aArray0) * width +
+                        (g0 - aGene0)],
+               t + (a - tr * mTileSize) * mTileSize + (g0 - tc * mTileSize),
+               (g1 - g0) * sizeof(double));
+    }
+}
+
+const double*
+MatrixQuery::tile(uint32_t aTileRow, uint32_t aTileColumn)
+{
+  uint64_t key = static_cast<uint64_t>(aTileRow) * mTileColumns + aTileColumn;
+
+  tile_index_t::iterator i(mTileIndex.find(key));
+  if (i != mTileIndex.end())
+  {
+    // Move it to the front, as the most recently used.
+    mTileCache.splice(mTileCache.begin(), mTileCache, (*i).second);
+    return mTileCache.front().mValues;
+  }
+
+  Tile t;
+  if (mTileCache.size() >= mCacheTiles)
+  {
+    // Reuse the least recently used tile's buffer.
+    t = mTileCache.back();
+    mTileIndex.erase(t.mKey);
+    mTileCache.pop_back();
+  }
+  else
+    t.mValues = new double[static_cast<uint64_t>(mTileSize) * mTileSize];
+  t.mKey = key;
+
+  uint64_t bytes = static_cast<uint64_t>(mTileSize) * mTileSize *
+    sizeof(double);
+  if (pread(mTiledFd, t.mValues, bytes, kTiledHeaderBytes + key * bytes) !=
+      static_cast<ssize_t>(bytes))
+  {
+    delete [] t.mValues;
+    throw RuntimeException("tiled_data is truncated.");
+  }
+
+  mTileCache.push_front(t);
+  mTileIndex.insert(tile_index_t::value_type(key, mTileCache.begin()));
+  return t.mValues;
+}
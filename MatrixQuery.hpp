@@ -0,0 +1,97 @@
+/*
+    MatrixQuery: Random access to single genes, arrays or blocks of a matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MATRIX_QUERY_HPP
+#define MATRIX_QUERY_HPP
+
+#include "Matrix.hpp"
+#include <boost/unordered_map.hpp>
+#include <list>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Fetches gene profiles (a gene across all arrays), array profiles (an array
+// across all genes) and blocks of arrays by genes from a matrix directory,
+// from whichever of its files will need the fewest pages read:
+//  - tiled_data, written by buildTiles(), holds the matrix in square tiles,
+//    so that any row, column or block only touches the tiles it overlaps.
+//    Recently used tiles are kept in an LRU cache, so that repeated
+//    interactive queries around the same area do not go back to the file.
+//  - data has each array's profile contiguous.
+//  - inverse_data has each gene's profile contiguous.
+// At least one of the three must exist. A tiled_data that no longer matches
+// data is ignored, with a warning. Values are always indexed as (array,
+// gene), the layout of data.
+class MatrixQuery
+{
+public:
+  static const uint32_t kDefaultTileSize = 64;
+  static const uint32_t kDefaultCacheTiles = 4096;
+
+  MatrixQuery(const std::string& aMatrixDir,
+              uint32_t aCacheTiles = kDefaultCacheTiles);
+  ~MatrixQuery();
+
+  // Writes tiled_data into aMatrixDir from its data file.
+  static void buildTiles(const std::string& aMatrixDir,
+                         uint32_t aTileSize = kDefaultTileSize);
+
+  const LabelIndex&
+  genes() const
+  {
+    return mGenes;
+  }
+
+  const LabelIndex&
+  arrays() const
+  {
+    return mArrays;
+  }
+
+  void geneProfile(uint32_t aGene, std::vector<double>& aValues);
+  void arrayProfile(uint32_t aArray, std::vector<double>& aValues);
+
+  // Fills aValues with arrays [aArray0, aArray1) by genes [aGene0, aGene1),
+  // one array after another.
+  void block(uint32_t aArray0, uint32_t aArray1, uint32_t aGene0,
+             uint32_t aGene1, std::vector<double>& aValues);
+
+private:
+  struct Tile
+  {
+    uint64_t mKey;
+    double* mValues;
+  };
+  typedef std::list<Tile> lru_t;
+  typedef boost::unordered_map<uint64_t, lru_t::iterator> tile_index_t;
+
+  LabelIndex mGenes, mArrays;
+  Matrix* mData, * mInverseData;
+  int mTiledFd;
+  uint32_t mTileSize, mTileColumns;
+  uint32_t mCacheTiles;
+  // Most recently used at the front.
+  lru_t mTileCache;
+  tile_index_t mTileIndex;
+
+  const double* tile(uint32_t aTileRow, uint32_t aTileColumn);
+  void blockFromTiles(uint32_t aArray0, uint32_t aArray1, uint32_t aGene0,
+                      uint32_t aGene1, std::vector<double>& aValues);
+};
+
+#endif // MATRIX_QUERY_HPP
@@ -0,0 +1,656 @@
+/*
+    MatrixStats: Summary statistics of a matrix, gathered a row at a time.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "MatrixStats.hpp"
+#include "Matrix.hpp"
+#include "RuntimeException.hpp"
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+const char* const MatrixStats::kDefaultQuantiles = "0.05,0.25,0.5,0.75,0.95";
+const char* const MatrixStats::kSavedName = "stats_state";
+
+static const double kNaN = std::numeric_limits<double>::quiet_NaN();
+static const double kInfinity = std::numeric_limits<double>::infinity();
+
+// Orders the indices of quantiles by the quantiles' values.
+struct QuantileLess
+{
+  QuantileLess(const std::vector<double>& aQuantiles)
+    : mQuantiles(aQuantiles)
+  {
+  }
+
+  bool
+  operator()(uint32_t a, uint32_t b) const
+  {
+    return mQuantiles[a] < mQuantiles[b];
+  }
+
+  const std::vector<double>& mQuantiles;
+};
+
+void
+QuantileSketch::compact(uint32_t aLevel)
+{
+  // A level above the first takes half a level at a time, so it can fill
+  // to half as much again before it is compacted.
+  if (aLevel + 1 == mLevels.size())
+  {
+    mLevels.resize(aLevel + 2);
+    mLevels[aLevel + 1].reserve(mCapacity + mCapacity / 2);
+  }
+  std::vector<double>& level = mLevels[aLevel], & next = mLevels[aLevel + 1];
+
+  // Values are added to the first level in any order, but the levels above
+  // it are kept sorted by merging in what comes up from below.
+  if (aLevel == 0)
+    std::sort(level.begin(), level.end());
+
+  // An odd value out stays behind, to be paired up next time.
+  uint32_t pairs = level.size() / 2;
+  uint32_t odd = (mOddCompactions >> aLevel) & 1;
+  mOddCompactions ^= static_cast<uint64_t>(1) << aLevel;
+  uint32_t before = next.size();
+  for (uint32_t i = 0; i < pairs; i++)
+    next.push_back(level[2 * i + odd]);
+  std::inplace_merge(next.begin(), next.begin() + before, next.end());
+  level.erase(level.begin(), level.begin() + 2 * pairs);
+
+  if (next.size() >= mCapacity)
+    compact(aLevel + 1);
+}
+
+double
+QuantileSketch::quantile(double aQ) const
+{
+  if (mCount == 0)
+    return kNaN;
+
+  // Compacting keeps the total weight the same, so the weights add up to
+  // the count.
+  std::vector<std::pair<double, uint64_t> > weighted;
+  for (uint32_t h = 0; h < mLevels.size(); h++)
+    for (uint32_t i = 0; i < mLevels[h].size(); i++)
+      weighted.push_back(std::make_pair(mLevels[h][i],
+                                        static_cast<uint64_t>(1) << h));
+  std::sort(weighted.begin(), weighted.end());
+
+  uint64_t rank = static_cast<uint64_t>(aQ * (mCount - 1) + 0.5);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < weighted.size(); i++)
+  {
+    seen += weighted[i].second;
+    if (seen > rank)
+      return weighted[i].first;
+  }
+  return weighted.back().first;
+}
+
+void
+QuantileSketch::merge(const QuantileSketch& aOther)
+{
+  if (aOther.mCount == 0)
+    return;
+  if (mCount == 0)
+    *this = aOther;
+  else
+  {
+    if (aOther.mCapacity != mCapacity)
+      throw RuntimeException("Sketches of different capacities cannot be "
+                             "merged.");
+
+    // Values of the same weight go into the same level; above the first,
+    // the levels stay sorted.
+    if (mLevels.size() < aOther.mLevels.size())
+      mLevels.resize(aOther.mLevels.size());
+    for (uint32_t h = 0; h < aOther.mLevels.size(); h++)
+    {
+      std::vector<double>& level = mLevels[h];
+      uint32_t before = level.size();
+      level.insert(level.end(), aOther.mLevels[h].begin(),
+                   aOther.mLevels[h].end());
+      if (h != 0)
+        std::inplace_merge(level.begin(), level.begin() + before,
+                           level.end());
+    }
+    mCount += aOther.mCount;
+
+    // Compacting a level can fill the one above, which is compacted in
+    // turn before the loop gets to it.
+    for (uint32_t h = 0; h < mLevels.size(); h++)
+      if (mLevels[h].size() >= mCapacity)
+        compact(h);
+  }
+
+  // As in add() and compact(), so that the levels grow no further than
+  // sketchBytes() allows for.
+  for (uint32_t h = 0; h < mLevels.size(); h++)
+    mLevels[h].reserve(h == 0 ? mCapacity : mCapacity + mCapacity / 2);
+}
+
+bool
+QuantileSketch::write(FILE* aFile) const
+{
+  uint64_t header[4] = { mCapacity, mCount, mOddCompactions, mLevels.size() };
+  bool ok = fwrite(header, sizeof(uint64_t), 4, aFile) == 4;
+  for (uint32_t h = 0; ok && h < mLevels.size(); h++)
+  {
+    uint64_t size = mLevels[h].size();
+    ok = fwrite(&size, sizeof(size), 1, aFile) == 1 &&
+      (size == 0 ||
+       fwrite(&mLevels[h][0], sizeof(double), size, aFile) == size);
+  }
+  return ok;
+}
+
+bool
+QuantileSketch::read(FILE* aFile)
+{
+  // The sizes are checked before anything is allocated for them, so that
+  // a damaged file is reported rather than exhausting memory.
+  uint64_t header[4];
+  if (fread(header, sizeof(uint64_t), 4, aFile) != 4 || header[0] < 2 ||
+      header[0] > 0xFFFFFFFFu || header[3] > 64)
+    return false;
+  mCapacity = header[0];
+  mCount = header[1];
+  mOddCompactions = header[2];
+  mLevels.assign(header[3], std::vector<double>());
+  for (uint32_t h = 0; h < mLevels.size(); h++)
+  {
+    uint64_t size;
+    if (fread(&size, sizeof(size), 1, aFile) != 1 || size > mCapacity)
+      return false;
+    mLevels[h].reserve(h == 0 ? mCapacity : mCapacity + mCapacity / 2);
+    mLevels[h].resize(size);
+    if (size != 0 &&
+        fread(&mLevels[h][0], sizeof(double), size, aFile) != size)
+      return false;
+  }
+  return true;
+}
+
+// Picks the sketch capacity for the constructor.
+static uint32_t
+chooseSketchCapacity(uint32_t aColumns, uint32_t aCapacity, uint64_t aRows)
+{
+  if (aCapacity != 0)
+    return aCapacity;
+  uint32_t capacity = QuantileSketch::kDefaultCapacity;
+  if (aRows != 0)
+    while (capacity > MatrixStats::kMinSketchCapacity &&
+           MatrixStats::sketchBytes(aColumns, aRows, capacity) >
+           MatrixStats::kSketchBudget)
+      capacity--;
+  return capacity;
+}
+
+MatrixStats::MatrixStats(uint32_t aColumns,
+                         const std::vector<double>& aQuantiles,
+                         uint32_t aSketchCapacity, uint64_t aRows)
+  : mnColumns(aColumns), mRowsAdded(0),
+    mSketchCapacity(chooseSketchCapacity(aColumns, aSketchCapacity, aRows)),
+    mQuantiles(aQuantiles),
+    mCount(aColumns, 0.0), mMean(aColumns, 0.0), mM2(aColumns, 0.0),
+    mMin(aColumns, kInfinity), mMax(aColumns, -kInfinity),
+    mSketches(aQuantiles.empty() ? 0 : aColumns,
+              QuantileSketch(mSketchCapacity))
+{
+  for (uint32_t q = 0; q < mQuantiles.size(); q++)
+    mQuantileOrder.push_back(q);
+  std::sort(mQuantileOrder.begin(), mQuantileOrder.end(),
+            QuantileLess(mQuantiles));
+}
+
+void
+MatrixStats::addRows(const double* aRows, uint32_t aCount, uint32_t aThreads)
+{
+  if (aCount == 0)
+    return;
+
+  mRowStats.resize((static_cast<uint64_t>(mRowsAdded) + aCount) *
+                   (kRowFields + mQuantiles.size()));
+
+  if (aThreads <= 1)
+    addShare(aRows, aCount, mRowsAdded, 0, 1);
+  else
+  {
+    boost::thread_group workers;
+    for (uint32_t t = 1; t < aThreads; t++)
+      workers.create_thread(boost::bind(&MatrixStats::addShare, this, aRows,
+                                        aCount, mRowsAdded, t, aThreads));
+    addShare(aRows, aCount, mRowsAdded, 0, aThreads);
+    workers.join_all();
+  }
+
+  mRowsAdded += aCount;
+}
+
+void
+MatrixStats::addShare(const double* aRows, uint32_t aCount,
+                      uint32_t aRowIndex, uint32_t aThread,
+                      uint32_t aThreads)
+{
+  uint32_t r0 = static_cast<uint64_t>(aCount) * aThread / aThreads,
+    r1 = static_cast<uint64_t>(aCount) * (aThread + 1) / aThreads;
+  addRowStats(aRows, r0, r1, aRowIndex);
+
+  uint32_t c0 = static_cast<uint64_t>(mnColumns) * aThread / aThreads,
+    c1 = static_cast<uint64_t>(mnColumns) * (aThread + 1) / aThreads;
+  addColumnStats(aRows, aCount, c0, c1);
+}
+
+void
+MatrixStats::addRowStats(const double* aRows, uint32_t aFirst, uint32_t aEnd,
+                         uint32_t aRowIndex)
+{
+  uint32_t stride = kRowFields + mQuantiles.size();
+  std::vector<double> values;
+  values.reserve(mnColumns);
+
+  for (uint32_t r = aFirst; r < aEnd; r++)
+  {
+    const double* row = aRows + static_cast<uint64_t>(r) * mnColumns;
+    double* stats = &mRowStats[(static_cast<uint64_t>(aRowIndex) + r) *
+                               stride];
+
+    values.clear();
+    double sum = 0.0;
+    for (uint32_t c = 0; c < mnColumns; c++)
+      if (finite(row[c]))
+      {
+        values.push_back(row[c]);
+        sum += row[c];
+      }
+
+    uint32_t n = values.size();
+    double mean = n == 0 ? kNaN : sum / n, m2 = 0.0;
+    for (uint32_t i = 0; i < n; i++)
+      m2 += (values[i] - mean) * (values[i] - mean);
+
+    stats[0] = n;
+    stats[1] = mnColumns - n;
+    stats[2] = mean;
+    stats[3] = n < 2 ? kNaN : m2 / (n - 1);
+    stats[4] = n == 0 ? kNaN : *std::min_element(values.begin(), values.end());
+    stats[5] = n == 0 ? kNaN : *std::max_element(values.begin(), values.end());
+
+    // Taking the quantiles in increasing order, each one only has to be
+    // looked for among the values above the last.
+    std::vector<double>::iterator from = values.begin();
+    for (uint32_t i = 0; i < mQuantileOrder.size(); i++)
+    {
+      uint32_t q = mQuantileOrder[i];
+      if (n == 0)
+      {
+        stats[kRowFields + q] = kNaN;
+        continue;
+      }
+      std::vector<double>::iterator at = values.begin() +
+        static_cast<uint32_t>(mQuantiles[q] * (n - 1) + 0.5);
+      std::nth_element(from, at, values.end());
+      stats[kRowFields + q] = *at;
+      from = at;
+    }
+  }
+}
+
+void
+MatrixStats::addColumnStats(const double* aRows, uint32_t aCount,
+                            uint32_t aFirst, uint32_t aEnd)
+{
+  double* count = &mCount[0], * mean = &mMean[0], * m2 = &mM2[0];
+  double* mn = &mMin[0], * mx = &mMax[0];
+
+  for (uint32_t r = 0; r < aCount; r++)
+  {
+    const double* row = aRows + static_cast<uint64_t>(r) * mnColumns;
+
+    // Welford's update, written without branches so that it vectorises:
+    // x - x is only 0 for finite x, and a value that is not finite is
+    // replaced by the mean, which leaves the mean and M2 as they were.
+    for (uint32_t c = aFirst; c < aEnd; c++)
+    {
+      double x = row[c];
+      bool ok = x - x == 0.0;
+      double v = ok ? x : mean[c];
+      double n = count[c] + (ok ? 1.0 : 0.0);
+      double delta = v - mean[c];
+      double newMean = mean[c] + delta / (n + (n == 0.0 ? 1.0 : 0.0));
+      m2[c] += delta * (v - newMean);
+      mean[c] = newMean;
+      count[c] = n;
+    }
+  }
+
+  // The rest goes a column at a time, so that each column's sketch stays in
+  // cache while the block's values for it are added.
+  bool sketch = !mQuantiles.empty();
+  for (uint32_t c = aFirst; c < aEnd; c++)
+  {
+    const double* p = aRows + c;
+    for (uint32_t r = 0; r < aCount; r++, p += mnColumns)
+    {
+      double x = *p;
+      if (!finite(x))
+        continue;
+      if (x < mn[c])
+        mn[c] = x;
+      if (x > mx[c])
+        mx[c] = x;
+      if (sketch)
+        mSketches[c].add(x);
+    }
+  }
+}
+
+void
+MatrixStats::merge(const MatrixStats& aOther)
+{
+  if (aOther.mnColumns != mnColumns || aOther.mQuantiles != mQuantiles)
+    throw RuntimeException("Statistics of different columns or quantiles "
+                           "cannot be merged.");
+  if (mRowsAdded == 0)
+    mSketchCapacity = aOther.mSketchCapacity;
+  else if (aOther.mRowsAdded != 0 &&
+           aOther.mSketchCapacity != mSketchCapacity)
+    throw RuntimeException("Statistics with different sketch capacities "
+                           "cannot be merged.");
+
+  mRowStats.insert(mRowStats.end(), aOther.mRowStats.begin(),
+                   aOther.mRowStats.end());
+  mRowsAdded += aOther.mRowsAdded;
+
+  // Chan et al.'s combination of two Welford states.
+  for (uint32_t c = 0; c < mnColumns; c++)
+  {
+    double na = mCount[c], nb = aOther.mCount[c];
+    if (nb == 0.0)
+      continue;
+    double n = na + nb, delta = aOther.mMean[c] - mMean[c];
+    mMean[c] += delta * nb / n;
+    mM2[c] += aOther.mM2[c] + delta * delta * na * nb / n;
+    mCount[c] = n;
+    mMin[c] = std::min(mMin[c], aOther.mMin[c]);
+    mMax[c] = std::max(mMax[c], aOther.mMax[c]);
+  }
+
+  for (uint32_t c = 0; c < mSketches.size(); c++)
+    mSketches[c].merge(aOther.mSketches[c]);
+}
+
+// A saved state is a StatsStateHeader, the quantiles, the row statistics,
+// the columns' counts, means, M2s, minimums and maximums, then the columns'
+// sketches.
+struct StatsStateHeader
+{
+  char mMagic[8];
+  uint32_t mColumns, mRows, mQuantiles, mSketchCapacity;
+};
+
+static const char kStatsStateMagic[8] = { 'M', 'S', 'T', 'A', 'T', 'S', '0',
+                                          '1' };
+
+static bool
+writeDoubles(FILE* aFile, const std::vector<double>& aValues)
+{
+  return aValues.empty() ||
+    fwrite(&aValues[0], sizeof(double), aValues.size(), aFile) ==
+    aValues.size();
+}
+
+static bool
+readDoubles(FILE* aFile, std::vector<double>& aValues)
+{
+  return aValues.empty() ||
+    fread(&aValues[0], sizeof(double), aValues.size(), aFile) ==
+    aValues.size();
+}
+
+void
+MatrixStats::save(const std::string& aPath) const
+{
+  StatsStateHeader h;
+  memcpy(h.mMagic, kStatsStateMagic, sizeof(h.mMagic));
+  h.mColumns = mnColumns;
+  h.mRows = mRowsAdded;
+  h.mQuantiles = mQuantiles.size();
+  h.mSketchCapacity = mSketchCapacity;
+
+  std::string tmp(aPath + ".tmp");
+  FILE* f = fopen(tmp.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the saved statistics file.");
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+    writeDoubles(f, mQuantiles) && writeDoubles(f, mRowStats) &&
+    writeDoubles(f, mCount) && writeDoubles(f, mMean) &&
+    writeDoubles(f, mM2) && writeDoubles(f, mMin) && writeDoubles(f, mMax);
+  for (uint32_t c = 0; ok && c < mSketches.size(); c++)
+    ok = mSketches[c].write(f);
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), aPath.c_str()) != 0)
+    throw RuntimeException("Failed to write the saved statistics file.");
+}
+
+void
+MatrixStats::addSaved(const std::string& aPath)
+{
+  FILE* f = fopen(aPath.c_str(), "r");
+  if (f == NULL)
+    throw RuntimeException("Cannot open a saved statistics file.");
+
+  StatsStateHeader h;
+  std::vector<double> quantiles;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+    memcmp(h.mMagic, kStatsStateMagic, sizeof(h.mMagic)) == 0 &&
+    h.mColumns == mnColumns && h.mQuantiles == mQuantiles.size();
+  if (ok)
+  {
+    quantiles.resize(h.mQuantiles);
+    ok = readDoubles(f, quantiles) && quantiles == mQuantiles;
+  }
+  if (!ok)
+  {
+    fclose(f);
+    throw RuntimeException("A saved statistics file is not for this "
+                           "matrix.");
+  }
+
+  MatrixStats saved(mnColumns, mQuantiles, h.mSketchCapacity);
+  saved.mRowsAdded = h.mRows;
+  saved.mRowStats.resize(static_cast<uint64_t>(h.mRows) *
+                         (kRowFields + mQuantiles.size()));
+  ok = readDoubles(f, saved.mRowStats) && readDoubles(f, saved.mCount) &&
+    readDoubles(f, saved.mMean) && readDoubles(f, saved.mM2) &&
+    readDoubles(f, saved.mMin) && readDoubles(f, saved.mMax);
+  for (uint32_t c = 0; ok && c < saved.mSketches.size(); c++)
+    ok = saved.mSketches[c].read(f) &&
+      saved.mSketches[c].count() == saved.mCount[c];
+  fclose(f);
+  if (!ok)
+    throw RuntimeException("A saved statistics file is incomplete.");
+
+  merge(saved);
+}
+
+std::vector<double>
+MatrixStats::columnStats() const
+{
+  uint32_t stride = kRowFields + mQuantiles.size();
+  std::vector<double> all(static_cast<uint64_t>(mnColumns) * stride);
+  for (uint32_t c = 0; c < mnColumns; c++)
+  {
+    double* stats = &all[static_cast<uint64_t>(c) * stride];
+    double n = mCount[c];
+    stats[0] = n;
+    stats[1] = mRowsAdded - n;
+    stats[2] = n == 0.0 ? kNaN : mMean[c];
+    stats[3] = n < 2.0 ? kNaN : mM2[c] / (n - 1);
+    stats[4] = n == 0.0 ? kNaN : mMin[c];
+    stats[5] = n == 0.0 ? kNaN : mMax[c];
+    for (uint32_t q = 0; q < mQuantiles.size(); q++)
+      stats[kRowFields + q] = mSketches[c].quantile(mQuantiles[q]);
+  }
+  return all;
+}
+
+void
+MatrixStats::writeStats(const std::string& aPath, const std::string& aLabels,
+                        const char* aLabelName, const double* aStats,
+                        uint32_t aLines) const
+{
+  std::vector<std::string> labels;
+  if (fs::exists(aLabels))
+    readLabels(aLabels, labels);
+
+  FILE* f = fopen(aPath.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open a statistics file.");
+
+  fprintf(f, "%s\tcount\tnonfinite_fraction\tmean\tvariance\tmin\tmax",
+          aLabelName);
+  for (uint32_t q = 0; q < mQuantiles.size(); q++)
+    fprintf(f, "\tq%g", mQuantiles[q]);
+  fprintf(f, "\n");
+
+  uint32_t stride = kRowFields + mQuantiles.size();
+  for (uint32_t i = 0; i < aLines; i++)
+  {
+    const double* stats = aStats + static_cast<uint64_t>(i) * stride;
+    if (i < labels.size())
+      fprintf(f, "%s", labels[i].c_str());
+    else
+      fprintf(f, "%u", i);
+
+    double total = stats[0] + stats[1];
+    fprintf(f, "\t%.0f\t%.10g", stats[0],
+            total == 0.0 ? kNaN : stats[1] / total);
+    for (uint32_t s = 2; s < stride; s++)
+      fprintf(f, "\t%.10g", stats[s]);
+    fprintf(f, "\n");
+  }
+
+  if (fclose(f) != 0)
+    throw RuntimeException("Failed to write a statistics file.");
+}
+
+void
+MatrixStats::write(const std::string& aMatrixDir, const std::string& aOutDir,
+                   bool aInverse) const
+{
+  fs::path matrix(aMatrixDir), out(aOutDir);
+  fs::path arrays = matrix / "arrays", genes = matrix / "genes";
+
+  // The columns' statistics are put into the same layout as the rows'.
+  std::vector<double> columns(columnStats());
+  const double* rowStats = mRowStats.empty() ? NULL : &mRowStats[0];
+  const double* colStats = columns.empty() ? NULL : &columns[0];
+  if (aInverse)
+  {
+    writeStats((out / "gene_stats").string(), genes.string(), "gene",
+               rowStats, mRowsAdded);
+    writeStats((out / "array_stats").string(), arrays.string(), "array",
+               colStats, mnColumns);
+  }
+  else
+  {
+    writeStats((out / "array_stats").string(), arrays.string(), "array",
+               rowStats, mRowsAdded);
+    writeStats((out / "gene_stats").string(), genes.string(), "gene",
+               colStats, mnColumns);
+  }
+}
+
+std::vector<double>
+MatrixStats::parseQuantiles(const std::string& aList)
+{
+  std::vector<double> quantiles;
+  const char* p = aList.c_str();
+  while (*p != 0)
+  {
+    char* end;
+    double q = strtod(p, &end);
+    if (end == p || q < 0.0 || q > 1.0 || (*end != ',' && *end != 0))
+      throw RuntimeException("Quantiles must be a comma separated list of "
+                             "numbers from 0 to 1.");
+    quantiles.push_back(q);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return quantiles;
+}
+
+std::vector<double>
+MatrixStats::defaultQuantiles()
+{
+  return parseQuantiles(kDefaultQuantiles);
+}
+
+uint64_t
+MatrixStats::sketchBytes(uint32_t aColumns, uint64_t aRows,
+                         uint32_t aCapacity)
+{
+  // The first level holds up to aCapacity values, and each level above it
+  // reserves half as much again.
+  uint64_t levels = 1;
+  for (uint64_t n = aRows; n >= aCapacity; n /= 2)
+    levels++;
+  uint64_t perSketch = sizeof(QuantileSketch) +
+    levels * sizeof(std::vector<double>) +
+    sizeof(double) * (aCapacity + (levels - 1) * (aCapacity + aCapacity / 2));
+  return aColumns * perSketch;
+}
+
+void
+MatrixStats::printSketchSize(uint64_t aRows) const
+{
+  if (mQuantiles.empty())
+    return;
+  std::cout << "Statistics: quantile sketches of capacity " << mSketchCapacity
+            << " for " << mnColumns << " columns, needing up to "
+            << ((sketchBytes(mnColumns, aRows, mSketchCapacity) +
+                 (1 << 20) - 1) >> 20)
+            << " MB" << std::endl;
+}
+
+po::options_description
+MatrixStats::options(const std::string& aWhere)
+{
+  std::string help("Also write array_stats and gene_stats, the count, "
+                   "non-finite fraction, mean, variance, range and quantiles "
+                   "of each array and gene, into " + aWhere + ". The column "
+                   "quantiles are estimated with sketches, whose size is "
+                   "printed first. The state behind them is saved there too, "
+                   "as " + std::string(kSavedName) + ", for a run that "
+                   "appends to the matrix to add to");
+  po::options_description desc;
+  desc.add_options()
+    ("stats", help.c_str())
+    ;
+  return desc;
+}
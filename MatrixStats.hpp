@@ -0,0 +1,225 @@
+/*
+    MatrixStats: Summary statistics of a matrix, gathered a row at a time.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MATRIX_STATS_HPP
+#define MATRIX_STATS_HPP
+
+#include <boost/program_options/options_description.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A sketch of a stream of values from which quantiles can be estimated in
+// bounded space. Values are kept in levels of at most aCapacity; when a
+// level fills up it is sorted and every other value moved up to the next
+// level, where each stands for twice as many values. The values kept
+// alternate between the odd and even ones, so the sketch is deterministic
+// and its rank error is about (levels / aCapacity) of the count. After n
+// values there are about log2(n / aCapacity) + 2 levels; see
+// MatrixStats::sketchBytes() for the memory they take.
+//
+// Two sketches of the same capacity are merged by putting their levels
+// together, level by level, and compacting any that are then full, so a
+// sketch of a stream can be put together from sketches of its parts.
+class QuantileSketch
+{
+public:
+  QuantileSketch(uint32_t aCapacity = kDefaultCapacity)
+    : mCapacity(aCapacity < 2 ? 2 : aCapacity), mCount(0), mOddCompactions(0)
+  {
+  }
+
+  void
+  add(double aValue)
+  {
+    if (mLevels.empty())
+    {
+      mLevels.resize(1);
+      mLevels[0].reserve(mCapacity);
+    }
+    mLevels[0].push_back(aValue);
+    mCount++;
+    if (mLevels[0].size() >= mCapacity)
+      compact(0);
+  }
+
+  uint64_t
+  count() const
+  {
+    return mCount;
+  }
+
+  // The value of rank aQ * (count - 1), rounded to the nearest; NaN if no
+  // values were added.
+  double quantile(double aQ) const;
+
+  // Adds the values aOther has seen, as if they had been added here. The
+  // capacities must be the same, unless this sketch is still empty.
+  void merge(const QuantileSketch& aOther);
+
+  // Write and read the sketch's state, for MatrixStats::save() and
+  // addSaved(). Each returns false on failure.
+  bool write(FILE* aFile) const;
+  bool read(FILE* aFile);
+
+  static const uint32_t kDefaultCapacity = 128;
+
+private:
+  uint32_t mCapacity;
+  uint64_t mCount;
+  // Bit h is set when level h is next to keep its odd values.
+  uint64_t mOddCompactions;
+  std::vector<std::vector<double> > mLevels;
+
+  void compact(uint32_t aLevel);
+};
+
+// Gathers, a row at a time, the count of finite values, fraction of values
+// that are not finite (NaN or infinite), mean, sample variance, minimum,
+// maximum and chosen quantiles of each row and of each column of a matrix,
+// in a single pass over it.
+//
+// Each row is in memory in full when it is added, so its statistics are
+// exact. Columns are only ever seen a value at a time: their means and
+// variances are kept with Welford's method, and their quantiles with a
+// QuantileSketch each. The sketches are most of the memory used, growing
+// with the number of columns and, slowly, of rows; see sketchBytes().
+//
+// The statistics of consecutive parts of a matrix, gathered separately by
+// shards or by runs that append to it, can be merged: the rows' are put
+// one after the other, the columns' Welford states are combined and their
+// sketches merged. save() writes the state to a file, and addSaved()
+// merges such a file in.
+class MatrixStats
+{
+public:
+  // A capacity of 0 picks QuantileSketch::kDefaultCapacity, or, if aRows
+  // (the number of rows expected) is given and the sketches would take more
+  // than kSketchBudget bytes, the largest capacity down to
+  // kMinSketchCapacity that keeps them within it.
+  MatrixStats(uint32_t aColumns, const std::vector<double>& aQuantiles =
+              defaultQuantiles(), uint32_t aSketchCapacity = 0,
+              uint64_t aRows = 0);
+
+  // Adds aCount consecutive rows. With several threads, each thread takes
+  // its own share of the rows for the row statistics and of the columns for
+  // the column statistics, so every accumulator has a single owner and the
+  // results are the same however many threads there are.
+  void addRows(const double* aRows, uint32_t aCount, uint32_t aThreads = 1);
+
+  void
+  addRow(const double* aRow)
+  {
+    addRows(aRow, 1);
+  }
+
+  // Adds the rows aOther has seen, as if they came after the rows added
+  // here. The columns and quantiles must be the same.
+  void merge(const MatrixStats& aOther);
+
+  // Saves the state to aPath, through a temporary file and a rename so
+  // that an interrupted save leaves any earlier state in place.
+  void save(const std::string& aPath) const;
+
+  // Merges in a state save() wrote.
+  void addSaved(const std::string& aPath);
+
+  uint32_t
+  rows() const
+  {
+    return mRowsAdded;
+  }
+
+  uint32_t
+  sketchCapacity() const
+  {
+    return mSketchCapacity;
+  }
+
+  // The statistics of each row, and of each column, in the order
+  // array_stats and gene_stats list them: count, values that are not
+  // finite, mean, variance, min and max, then the quantiles.
+  const std::vector<double>&
+  rowStats() const
+  {
+    return mRowStats;
+  }
+
+  std::vector<double> columnStats() const;
+
+  // An upper bound on the memory aColumns sketches of aCapacity take once
+  // aRows rows have been added.
+  static uint64_t sketchBytes(uint32_t aColumns, uint64_t aRows,
+                              uint32_t aCapacity);
+
+  // Prints, to stdout, the sketch capacity chosen and about how much memory
+  // the sketches will need over aRows rows.
+  void printSketchSize(uint64_t aRows) const;
+
+  // Writes array_stats and gene_stats into aOutDir, one tab separated line
+  // for each array or gene, for a matrix in aMatrixDir whose rows are
+  // arrays, or genes with aInverse.
+  void write(const std::string& aMatrixDir, const std::string& aOutDir,
+             bool aInverse) const;
+
+  // Parses a comma separated list of quantiles, such as "0.25,0.5,0.75".
+  static std::vector<double> parseQuantiles(const std::string& aList);
+  static std::vector<double> defaultQuantiles();
+  static const char* const kDefaultQuantiles;
+
+  // The name of the state the tools save beside a matrix's statistics, so
+  // that a run appending to the matrix can add to them.
+  static const char* const kSavedName;
+
+  // The --stats option of the tools that can gather statistics while they
+  // run, writing them into aWhere.
+  static boost::program_options::options_description
+  options(const std::string& aWhere);
+
+  static const uint64_t kSketchBudget = static_cast<uint64_t>(512) << 20;
+  static const uint32_t kMinSketchCapacity = 16;
+
+private:
+  // The number of statistics kept for each row before its quantiles.
+  static const uint32_t kRowFields = 6;
+
+  uint32_t mnColumns, mRowsAdded, mSketchCapacity;
+  std::vector<double> mQuantiles;
+  // The indices of mQuantiles, from the smallest quantile to the largest.
+  std::vector<uint32_t> mQuantileOrder;
+
+  // kRowFields then the quantiles for each row; see rowStats().
+  std::vector<double> mRowStats;
+
+  // For each column, laid out so that a row updates them all in one
+  // vectorisable loop.
+  std::vector<double> mCount, mMean, mM2, mMin, mMax;
+  std::vector<QuantileSketch> mSketches;
+
+  void addRowStats(const double* aRows, uint32_t aFirst, uint32_t aEnd,
+                   uint32_t aRowIndex);
+  void addColumnStats(const double* aRows, uint32_t aCount, uint32_t aFirst,
+                      uint32_t aEnd);
+  void addShare(const double* aRows, uint32_t aCount, uint32_t aRowIndex,
+                uint32_t aThread, uint32_t aThreads);
+  void writeStats(const std::string& aPath, const std::string& aLabels,
+                  const char* aLabelName, const double* aStats,
+                  uint32_t aLines) const;
+};
+
+#endif // MATRIX_STATS_HPP
@@ -0,0 +1,205 @@
+/*
+    Profile: Counters and timers for reporting on a run.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Profile.hpp"
+#include "RuntimeException.hpp"
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <cstdio>
+#include <vector>
+#include <time.h>
+
+bool Profile::sEnabled = false;
+
+// Counters and timers are kept in the order they were created, so that
+// reports list them in a stable order.
+static boost::mutex sRegistryMutex;
+static std::vector<ProfileCounter*> sCounters;
+static std::vector<ProfileTimer*> sTimers;
+static uint64_t sStartTime = Profile::now();
+
+static boost::mutex sProgressMutex;
+static boost::condition_variable sProgressStop;
+static boost::thread* sProgressThread = NULL;
+static bool sStopping = false;
+
+ProfileCounter&
+Profile::counter(const std::string& aName)
+{
+  boost::mutex::scoped_lock lock(sRegistryMutex);
+  for (std::vector<ProfileCounter*>::iterator i = sCounters.begin();
+       i != sCounters.end(); i++)
+    if ((*i)->name() == aName)
+      return **i;
+  sCounters.push_back(new ProfileCounter(aName));
+  return *sCounters.back();
+}
+
+ProfileTimer&
+Profile::timer(const std::string& aName)
+{
+  boost::mutex::scoped_lock lock(sRegistryMutex);
+  for (std::vector<ProfileTimer*>::iterator i = sTimers.begin();
+       i != sTimers.end(); i++)
+    if ((*i)->name() == aName)
+      return **i;
+  sTimers.push_back(new ProfileTimer(aName));
+  return *sTimers.back();
+}
+
+void
+Profile::enable()
+{
+  sEnabled = true;
+}
+
+uint64_t
+Profile::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// Prints aValue with a k, M or G suffix.
+static void
+printScaled(FILE* aOut, double aValue)
+{
+  static const char* suffixes[] = { "", "k", "M", "G", "T" };
+  uint32_t s = 0;
+  while (aValue >= 1000.0 && s < 4)
+  {
+    aValue /= 1000.0;
+    s++;
+  }
+  fprintf(aOut, s == 0 ? "%.0f%s" : "%.1f%s", aValue, suffixes[s]);
+}
+
+static void
+reportProgress(std::string aTool, uint32_t aSeconds)
+{
+  std::vector<uint64_t> last;
+  uint64_t lastTime = Profile::now();
+  boost::system_time deadline = boost::get_system_time();
+
+  boost::mutex::scoped_lock lock(sProgressMutex);
+  while (!sStopping)
+  {
+    // Waking up early, spuriously, must not print a line or move the next
+    // one along.
+    deadline += boost::posix_time::seconds(aSeconds);
+    while (!sStopping && boost::get_system_time() < deadline)
+      sProgressStop.timed_wait(lock, deadline);
+    if (sStopping)
+      return;
+
+    std::vector<ProfileCounter*> counters;
+    {
+      boost::mutex::scoped_lock rlock(sRegistryMutex);
+      counters = sCounters;
+    }
+
+    uint64_t t = Profile::now();
+    double dt = (t - lastTime) / 1E9;
+    fprintf(stderr, "%s %.0fs:", aTool.c_str(), (t - sStartTime) / 1E9);
+    for (uint32_t i = 0; i < counters.size(); i++)
+    {
+      uint64_t v = counters[i]->value();
+      if (i >= last.size())
+        last.push_back(0);
+      fprintf(stderr, " %s ", counters[i]->name().c_str());
+      printScaled(stderr, v);
+      fprintf(stderr, " (");
+      printScaled(stderr, dt > 0 ? (v - last[i]) / dt : 0.0);
+      fprintf(stderr, "/s)");
+      last[i] = v;
+    }
+    fprintf(stderr, "\n");
+    lastTime = t;
+  }
+}
+
+void
+Profile::startProgress(const std::string& aTool, uint32_t aSeconds)
+{
+  if (aSeconds == 0 || sProgressThread != NULL)
+    return;
+  sStopping = false;
+  sProgressThread = new boost::thread(boost::bind(reportProgress, aTool,
+                                                  aSeconds));
+}
+
+void
+Profile::stopProgress()
+{
+  if (sProgressThread == NULL)
+    return;
+  {
+    boost::mutex::scoped_lock lock(sProgressMutex);
+    sStopping = true;
+  }
+  sProgressStop.notify_all();
+  sProgressThread->join();
+  delete sProgressThread;
+  sProgressThread = NULL;
+}
+
+boost::program_options::options_description
+Profile::options(std::string& aProfile, uint32_t& aProgress)
+{
+  namespace po = boost::program_options;
+  po::options_description desc;
+  desc.add_options()
+    ("profile", po::value<std::string>(&aProfile),
+     "Write counters and timings for the run to this file, as JSON")
+    ("progress", po::value<uint32_t>(&aProgress),
+     "Print the counters and their rates to stderr every this many seconds "
+     "(default 0, for never)")
+    ;
+  return desc;
+}
+
+void
+Profile::writeReport(const std::string& aPath, const std::string& aTool)
+{
+  FILE* f = fopen(aPath.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the profile report file.");
+
+  boost::mutex::scoped_lock lock(sRegistryMutex);
+  fprintf(f, "{\n  \"tool\": \"%s\",\n  \"wall_seconds\": %.6f,\n"
+          "  \"counters\": {", aTool.c_str(), (now() - sStartTime) / 1E9);
+  for (uint32_t i = 0; i < sCounters.size(); i++)
+    fprintf(f, "%s\n    \"%s\": %llu", i == 0 ? "" : ",",
+            sCounters[i]->name().c_str(),
+            static_cast<unsigned long long>(sCounters[i]->value()));
+  fprintf(f, "\n  },\n  \"timers\": {");
+  for (uint32_t i = 0; i < sTimers.size(); i++)
+  {
+    uint64_t ns = sTimers[i]->nanoseconds(), calls = sTimers[i]->calls();
+    fprintf(f, "%s\n    \"%s\": { \"seconds\": %.6f, \"calls\": %llu, "
+            "\"mean_microseconds\": %.3f }", i == 0 ? "" : ",",
+            sTimers[i]->name().c_str(), ns / 1E9,
+            static_cast<unsigned long long>(calls),
+            calls == 0 ? 0.0 : ns / 1E3 / calls);
+  }
+  fprintf(f, "\n  }\n}\n");
+  fclose(f);
+}
@@ -0,0 +1,182 @@
+/*
+    Profile: Counters and timers for reporting on a run.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <string>
+#include <stdint.h>
+
+// A named count of something done during a run. Counters are created
+// through Profile::counter(), and live until the program exits. They may be
+// added to from any thread.
+class ProfileCounter
+{
+public:
+  explicit ProfileCounter(const std::string& aName)
+    : mName(aName), mValue(0)
+  {
+  }
+
+  void
+  add(uint64_t aN = 1)
+  {
+    mValue.fetch_add(aN, boost::memory_order_relaxed);
+  }
+
+  // For counters with a single writer, which can keep a running total of
+  // their own and publish it now and then.
+  void
+  set(uint64_t aValue)
+  {
+    mValue.store(aValue, boost::memory_order_relaxed);
+  }
+
+  uint64_t
+  value() const
+  {
+    return mValue.load(boost::memory_order_relaxed);
+  }
+
+  const std::string&
+  name() const
+  {
+    return mName;
+  }
+
+private:
+  std::string mName;
+  boost::atomic<uint64_t> mValue;
+};
+
+// The total time spent in something, and the number of times it was done.
+// Nothing is timed unless profiling has been turned on.
+class ProfileTimer
+{
+public:
+  explicit ProfileTimer(const std::string& aName)
+    : mName(aName), mNanoseconds(0), mCalls(0)
+  {
+  }
+
+  void
+  add(uint64_t aNanoseconds)
+  {
+    mNanoseconds.fetch_add(aNanoseconds, boost::memory_order_relaxed);
+    mCalls.fetch_add(1, boost::memory_order_relaxed);
+  }
+
+  uint64_t
+  nanoseconds() const
+  {
+    return mNanoseconds.load(boost::memory_order_relaxed);
+  }
+
+  uint64_t
+  calls() const
+  {
+    return mCalls.load(boost::memory_order_relaxed);
+  }
+
+  const std::string&
+  name() const
+  {
+    return mName;
+  }
+
+private:
+  std::string mName;
+  boost::atomic<uint64_t> mNanoseconds, mCalls;
+};
+
+class Profile
+{
+public:
+  // The counter or timer with a given name, created the first time it is
+  // asked for. Look them up once, not every time they are used.
+  static ProfileCounter& counter(const std::string& aName);
+  static ProfileTimer& timer(const std::string& aName);
+
+  // Turns the timers on.
+  static void enable();
+
+  static bool
+  enabled()
+  {
+    return sEnabled;
+  }
+
+  // A monotonic clock, in nanoseconds.
+  static uint64_t now();
+
+  // Prints a line of every counter, and its rate, to stderr every aSeconds
+  // seconds until stopProgress().
+  static void startProgress(const std::string& aTool, uint32_t aSeconds);
+  static void stopProgress();
+
+  // Writes every counter and timer to aPath as JSON.
+  static void writeReport(const std::string& aPath, const std::string& aTool);
+
+  // The --profile and --progress options every tool takes, read into
+  // aProfile and aProgress. aProgress should start out as 0: the progress
+  // line is only printed when it is asked for.
+  static boost::program_options::options_description
+  options(std::string& aProfile, uint32_t& aProgress);
+
+private:
+  static bool sEnabled;
+};
+
+// Prints the progress line, if aSeconds is not 0, until the end of the scope,
+// however the scope is left.
+class ScopedProgress
+{
+public:
+  ScopedProgress(const std::string& aTool, uint32_t aSeconds)
+  {
+    Profile::startProgress(aTool, aSeconds);
+  }
+
+  ~ScopedProgress()
+  {
+    Profile::stopProgress();
+  }
+};
+
+// Adds the time until the end of the scope to a timer, if profiling is on.
+class ScopedProfileTimer
+{
+public:
+  ScopedProfileTimer(ProfileTimer& aTimer)
+    : mTimer(aTimer), mStart(Profile::enabled() ? Profile::now() : 0)
+  {
+  }
+
+  ~ScopedProfileTimer()
+  {
+    if (mStart != 0)
+      mTimer.add(Profile::now() - mStart);
+  }
+
+private:
+  ProfileTimer& mTimer;
+  uint64_t mStart;
+};
+
+#endif // PROFILE_HPP
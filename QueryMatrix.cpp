@@ -0,0 +1,221 @@
+/*
+    QueryMatrix: Look up single genes, arrays or blocks of a matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include "MatrixQuery.hpp"
+#include "RuntimeException.hpp"
+#include <iostream>
+#include <sstream>
+#include <sys/time.h>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+static double
+now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1E6;
+}
+
+static void
+printProfile(const std::vector<std::string>& aLabels,
+             const std::vector<double>& aValues)
+{
+  for (uint32_t i = 0; i < aValues.size(); i++)
+    std::cout << aLabels[i] << "\t" << aValues[i] << std::endl;
+}
+
+static bool
+runQuery(MatrixQuery& aQuery, const std::string& aCommand)
+{
+  std::istringstream cmd(aCommand);
+  std::string verb;
+  cmd >> verb;
+
+  std::vector<double> values;
+  double start = now();
+
+  if (verb == "gene" || verb == "array")
+  {
+    std::string name;
+    cmd >> name;
+    const LabelIndex& li(verb == "gene" ? aQuery.genes() : aQuery.arrays());
+    uint32_t index = li.find(name);
+    if (index == LabelIndex::kNotFound)
+    {
+      std::cerr << "No such " << verb << ": " << name << std::endl;
+      return false;
+    }
+
+    if (verb == "gene")
+    {
+      aQuery.geneProfile(index, values);
+      printProfile(aQuery.arrays().labels(), values);
+    }
+    else
+    {
+      aQuery.arrayProfile(index, values);
+      printProfile(aQuery.genes().labels(), values);
+    }
+  }
+  else if (verb == "block")
+  {
+    uint32_t a0, a1, g0, g1;
+    if (!(cmd >> a0 >> a1 >> g0 >> g1))
+    {
+      std::cerr << "Usage: block array0 array1 gene0 gene1" << std::endl;
+      return false;
+    }
+    aQuery.block(a0, a1, g0, g1, values);
+
+    const std::vector<std::string>& genes(aQuery.genes().labels());
+    const std::vector<std::string>& arrays(aQuery.arrays().labels());
+    for (uint32_t g = g0; g < g1; g++)
+      std::cout << "\t" << genes[g];
+    std::cout << std::endl;
+    for (uint32_t a = a0; a < a1; a++)
+    {
+      std::cout << arrays[a];
+      for (uint32_t g = g0; g < g1; g++)
+        std::cout << "\t" << values[(a - a0) * (g1 - g0) + (g - g0)];
+      std::cout << std::endl;
+    }
+  }
+  else
+  {
+    std::cerr << "Unknown query: " << aCommand << std::endl;
+    return false;
+  }
+
+  std::cerr << "(" << (now() - start) * 1000.0 << " ms)" << std::endl;
+  return true;
+}
+
+int
+main(int argc, char** argv)
+{
+  std::string matrixdir, gene, array, block;
+  uint32_t tileSize = MatrixQuery::kDefaultTileSize,
+    cacheTiles = MatrixQuery::kDefaultCacheTiles;
+  po::options_description desc;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir), "The directory to read the data from")
+    ("build_tiles", "Write tiled_data into the matrix directory from data, "
+     "for fast random access")
+    ("tile_size", po::value<uint32_t>(&tileSize),
+     "With --build_tiles, the width and height of each tile (default 64)")
+    ("cache_tiles", po::value<uint32_t>(&cacheTiles),
+     "The number of tiles to keep cached (default 4096)")
+    ("gene", po::value<std::string>(&gene),
+     "Print the values for the named gene across all arrays")
+    ("array", po::value<std::string>(&array),
+     "Print the values for the named array across all genes")
+    ("block", po::value<std::string>(&block),
+     "Print the block of arrays a0 to a1 and genes g0 to g1 (exclusive), "
+     "given as 'a0 a1 g0 g1'")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    std::cout << "With no query options, queries are read one per line from "
+      "standard input, as 'gene NAME', 'array NAME' or "
+      "'block a0 a1 g0 g1'." << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cerr << "Invalid matrix directory path supplied" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    if (vm.count("build_tiles"))
+    {
+      if (tileSize == 0)
+      {
+        std::cerr << "Invalid tile size supplied" << std::endl;
+        return 1;
+      }
+      MatrixQuery::buildTiles(matrixdir, tileSize);
+      return 0;
+    }
+
+    MatrixQuery mq(matrixdir, cacheTiles);
+
+    if (vm.count("gene") || vm.count("array") || vm.count("block"))
+    {
+      bool ok = true;
+      if (vm.count("gene"))
+        ok = runQuery(mq, "gene " + gene) && ok;
+      if (vm.count("array"))
+        ok = runQuery(mq, "array " + array) && ok;
+      if (vm.count("block"))
+        ok = runQuery(mq, "block " + block) && ok;
+      return ok ? 0 : 1;
+    }
+
+    while (std::cin.good())
+    {
+      std::string l;
+      std::getline(std::cin, l);
+      if (l == "" || l == "quit")
+      {
+        if (!std::cin.good() || l == "quit")
+          break;
+        continue;
+      }
+      try
+      {
+        runQuery(mq, l);
+      }
+      catch (RuntimeException& e)
+      {
+        std::cerr << "Error: " << e.what() << std::endl;
+      }
+      std::cout.flush();
+    }
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
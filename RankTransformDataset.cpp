@@ -17,200 +17,518 @@
 */
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/lambda/lambda.hpp>
-#include <boost/lambda/bind.hpp>
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/mersenne_twister.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/lexical_cast.hpp>
+#include "Matrix.hpp"
+#include "MatrixStats.hpp"
+#include "Profile.hpp"
+#include "RowReader.hpp"
+#include "RowRanker.hpp"
+#include "RuntimeException.hpp"
+#include "Shard.hpp"
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
-namespace bll = boost::lambda;
 
 class RankTransformer
 {
 public:
+  enum ReplicateLayout
+  {
+    // One output file per replicate, named <output>.<replicate>.
+    kReplicateFiles,
+    // A single output file holding each replicate's matrix in turn.
+    kReplicateCombined
+  };
+
+  // How a shard deals with quantile normalisation, which needs every row
+  // before any can be ranked.
+  enum RankAveragesPass
+  {
+    // Work the averages out from the rows being ranked (only right for the
+    // whole matrix).
+    kComputeRankAverages,
+    // Only add up this shard's rank sums, into <output>.rank_sums.<shard>,
+    // for mergeRankSums().
+    kRankSumsOnly,
+    // Rank with the averages mergeRankSums() wrote to
+    // <output>.rank_averages.
+    kUseRankAverages
+  };
+
   RankTransformer(const std::string& aMatrixDir, const std::string& aOutputfile,
                   bool aQuantileNormalisation = false, bool aUseInverse = false,
-                  bool aScramble = false)
-    : mMatrixDir(aMatrixDir), mOutputFile(NULL), mData(NULL), mBuf(NULL),
-      mRanks(NULL), mInvRanks(NULL), mRankAvgs(NULL), mRankCounts(NULL),
-      mQuantileNormalisation(aQuantileNormalisation), mUseInverse(aUseInverse),
-      mScramble(aScramble)
+                  bool aScramble = false, uint32_t aReplicates = 1,
+                  uint64_t aSeed = 0,
+                  ReplicateLayout aLayout = kReplicateFiles,
+                  uint32_t aThreads = 1, bool aAppend = false,
+                  const Shard& aShard = Shard(),
+                  RankAveragesPass aPass = kComputeRankAverages,
+                  bool aStats = false)
+    : mMatrixDir(aMatrixDir), mOutputFile(NULL), mData(NULL), mRow(NULL),
+      mRanker(NULL), mQuantileNormalisation(aQuantileNormalisation),
+      mUseInverse(aUseInverse), mScramble(aScramble),
+      mnReplicates(aReplicates), mSeed(aSeed),
+      mLayout(aLayout), mnThreads(aThreads), mnRows(0), mFirstRow(0),
+      mEndRow(0), mRowIndex(0), mShard(aShard), mPass(aPass),
+      mOutputName(aOutputfile), mStartWork(NULL), mWorkDone(NULL),
+      mStopping(false), mWriteFailed(false), mStats(NULL)
   {
-    mOutputFile = fopen(aOutputfile.c_str(), "w");
+    fs::path data(dataPath(mMatrixDir, mUseInverse));
+    nGenes = countRowLength(mMatrixDir, mUseInverse);
 
-    fs::path data(mMatrixDir);
-    if (mUseInverse)
-      data /= "inverse_data";
-    else
-      data /= "data";
+    if (nGenes != 0)
+      mnRows = fs::file_size(data) / (nGenes * sizeof(double));
+    mEndRow = mnRows;
 
-    mData = fopen(data.string().c_str(), "r");
+    if (!mScramble)
+      mnReplicates = 1;
+    if (mnThreads > mnReplicates)
+      mnThreads = mnReplicates;
+    if (mnThreads == 0)
+      mnThreads = 1;
 
-    fs::path genes(mMatrixDir);
-    // Ugly hack: if we are using the inverted data, we simply swap out the
-    // list of genes for the list of arrays, so that nGenes is actually the
-    // number of arrays. This means that the normalisation occurs as normal,
-    // except for each gene across arrays instead of for each array across
-    // genes.
-    if (mUseInverse)
-      genes /= "arrays";
-    else
-      genes /= "genes";
-    nGenes = 0;
-    std::ifstream gs(genes.string().c_str());
-    while (gs.good())
+    // Each row is ranked independently of the others (short of quantile
+    // normalisation, which the caller rules out), so appending only has to
+    // rank the rows past the end of the existing output.
+    if (aAppend)
     {
-      std::string l;
-      std::getline(gs, l);
-      if (!gs.good())
-        break;
+      mFirstRow = existingRows(outputName(aOutputfile, 0));
+      for (uint32_t r = 1; r < mnReplicates; r++)
+        if (existingRows(outputName(aOutputfile, r)) != mFirstRow)
+          throw RuntimeException("The replicate outputs have different "
+                                 "numbers of rows.");
+      if (mFirstRow > mnRows)
+        throw RuntimeException("The output has more rows than the data.");
+    }
 
-      nGenes++;
+    // Shards are split on the rank sum blocks, so that their sums add up
+    // to the same averages as a single pass over the whole matrix.
+    if (!mShard.whole())
+    {
+      uint64_t first, end;
+      mShard.rowRange(mnRows, RowRanker::kRankBlockRows, first, end);
+      mFirstRow = first;
+      mEndRow = end;
     }
 
-    mBuf = new double[nGenes];
-    mRanks = new double[nGenes];
-    if (mQuantileNormalisation)
+    mData = new RowReader(data.string(), nGenes, 0, 3, mFirstRow, mEndRow);
+
+    if (mPass != kRankSumsOnly)
+      openOutputs(aOutputfile, aAppend);
+
+    mRanker = new RowRanker(nGenes, mQuantileNormalisation);
+    for (uint32_t i = 0; i < mnThreads; i++)
+      mWorkspaces.push_back(new RankWorkspace(nGenes));
+
+    // The statistics of the rows are gathered as they are read for
+    // ranking, which a rank sums pass does not do. The sketch capacity is
+    // picked for the whole matrix, so that every shard picks the same one
+    // and their statistics can be merged; appending carries on from the
+    // state saved for the rows before.
+    if (aStats && mPass != kRankSumsOnly)
     {
-      mRankAvgs = new double[nGenes];
-      mRankCounts = new uint32_t[nGenes];
-      memset(mRankAvgs, 0, sizeof(double) * nGenes);
-      memset(mRankCounts, 0, sizeof(uint32_t) * nGenes);
+      mStats = new MatrixStats(nGenes, MatrixStats::defaultQuantiles(), 0,
+                               mnRows);
+      if (aAppend)
+      {
+        mStats->addSaved((mMatrixDir / MatrixStats::kSavedName).string());
+        if (mStats->rows() != mFirstRow)
+          throw RuntimeException("The saved statistics are not for the rows "
+                                 "already ranked.");
+      }
+      mStats->printSketchSize(mnRows);
     }
-    mInvRanks = new uint32_t[nGenes];
 
     processAllData();
+
+    // Replicates may be written from worker threads, so failures are only
+    // noted there, and reported here.
+    if (mWriteFailed)
+      throw RuntimeException("Failed to write a replicate output.");
+
+    // A shard's statistics are only of its own rows, so they are saved for
+    // mergeStats() to put together. The state of a whole matrix's rows is
+    // kept beside its statistics, for a later --append to add to.
+    if (mStats != NULL && !mShard.whole())
+      mStats->save(statsName(mOutputName, mShard.index()));
+    else if (mStats != NULL)
+      writeStats(*mStats, mMatrixDir, mUseInverse);
+  }
+
+  // Merges the statistics saved by aShards shards, in order, and writes
+  // them as a single pass over the matrix would have.
+  static void
+  mergeStats(const std::string& aMatrixDir, const std::string& aOutputfile,
+             bool aUseInverse, uint32_t aShards)
+  {
+    MatrixStats stats(countRowLength(aMatrixDir, aUseInverse));
+    for (uint32_t s = 0; s < aShards; s++)
+      stats.addSaved(statsName(aOutputfile, s));
+    writeStats(stats, aMatrixDir, aUseInverse);
+  }
+
+  static std::string
+  statsName(const std::string& aOutputfile, uint32_t aShard)
+  {
+    return aOutputfile + ".stats_state." +
+      boost::lexical_cast<std::string>(aShard);
+  }
+
+  // Adds up the rank sums written by aShards shards with kRankSumsOnly, in
+  // order, and writes the averages for the kUseRankAverages pass.
+  static void
+  mergeRankSums(const std::string& aMatrixDir, const std::string& aOutputfile,
+                bool aUseInverse, uint32_t aShards)
+  {
+    RowRanker ranker(countRowLength(aMatrixDir, aUseInverse), true);
+    for (uint32_t s = 0; s < aShards; s++)
+      ranker.addRankSums(rankSumsName(aOutputfile, s));
+    ranker.finishRankAverages();
+    ranker.writeRankAverages(rankAveragesName(aOutputfile));
+  }
+
+  static std::string
+  rankSumsName(const std::string& aOutputfile, uint32_t aShard)
+  {
+    return aOutputfile + ".rank_sums." +
+      boost::lexical_cast<std::string>(aShard);
+  }
+
+  static std::string
+  rankAveragesName(const std::string& aOutputfile)
+  {
+    return aOutputfile + ".rank_averages";
   }
 
   ~RankTransformer()
   {
     if (mOutputFile != NULL)
       fclose(mOutputFile);
+    for (std::vector<int>::iterator i = mReplicateFds.begin();
+         i != mReplicateFds.end(); i++)
+      close(*i);
     if (mData != NULL)
-      fclose(mData);
-    if (mBuf != NULL)
-      delete [] mBuf;
-    if (mInvRanks != NULL)
-      delete [] mInvRanks;
-    if (mRankCounts != NULL)
-      delete [] mRankCounts;
-    if (mRankAvgs != NULL)
-      delete [] mRankAvgs;
+      delete mData;
+    for (std::vector<RankWorkspace*>::iterator i = mWorkspaces.begin();
+         i != mWorkspaces.end(); i++)
+      delete *i;
+    if (mRanker != NULL)
+      delete mRanker;
+    if (mStats != NULL)
+      delete mStats;
   }
 
 private:
   fs::path mMatrixDir;
-  FILE* mOutputFile, * mData;
-  double* mBuf, * mRanks;
+  FILE* mOutputFile;
+  RowReader* mData;
+  // The row being processed, which points into mData's buffers.
+  const double* mRow;
   uint32_t nGenes;
-  uint32_t* mInvRanks;
-  double * mRankAvgs;
-  uint32_t * mRankCounts;
+  RowRanker* mRanker;
   bool mQuantileNormalisation, mUseInverse, mScramble;
-  boost::mt19937 mRand;
+  uint32_t mnReplicates;
+  uint64_t mSeed;
+  ReplicateLayout mLayout;
+  uint32_t mnThreads, mnRows, mFirstRow, mEndRow, mRowIndex;
+  Shard mShard;
+  RankAveragesPass mPass;
+  std::string mOutputName;
+  std::vector<RankWorkspace*> mWorkspaces;
+  std::vector<int> mReplicateFds;
+  boost::barrier* mStartWork, * mWorkDone;
+  bool mStopping, mWriteFailed;
+  MatrixStats* mStats;
+
+  static fs::path
+  dataPath(const fs::path& aMatrixDir, bool aUseInverse)
+  {
+    return aMatrixDir / (aUseInverse ? "inverse_data" : "data");
+  }
+
+  static uint32_t
+  countRowLength(const fs::path& aMatrixDir, bool aUseInverse)
+  {
+    // Ugly hack: if we are using the inverted data, we simply swap out the
+    // list of genes for the list of arrays, so that nGenes is actually the
+    // number of arrays. This means that the normalisation occurs as normal,
+    // except for each gene across arrays instead of for each array across
+    // genes.
+    return countLabels((aMatrixDir /
+                        (aUseInverse ? "arrays" : "genes")).string());
+  }
+
+  std::string
+  outputName(const std::string& aOutputfile, uint32_t aReplicate)
+  {
+    if (mnReplicates == 1 || mLayout == kReplicateCombined)
+      return aOutputfile;
+    return aOutputfile + "." + boost::lexical_cast<std::string>(aReplicate);
+  }
+
+  uint32_t
+  existingRows(const std::string& aPath)
+  {
+    if (!fs::exists(aPath))
+      return 0;
+
+    uint64_t size = fs::file_size(aPath), rowBytes = nGenes * sizeof(double);
+    if (rowBytes == 0 || size % rowBytes != 0)
+      throw RuntimeException("The existing output ends in a partial row.");
+    return size / rowBytes;
+  }
 
   void
-  processAllData()
+  openOutputs(const std::string& aOutputfile, bool aAppend)
   {
-    if (mQuantileNormalisation)
+    int flags = O_WRONLY | O_CREAT | (aAppend ? 0 : O_TRUNC);
+
+    // A shard writes its rows into place in the full-sized outputs, which
+    // the other shards are writing into at the same time.
+    if (!mShard.whole())
     {
-      while (fread(mBuf, sizeof(double), nGenes, mData) == nGenes)
+      flags = O_WRONLY | O_CREAT;
+      uint64_t rowBytes = static_cast<uint64_t>(nGenes) * sizeof(double);
+      uint32_t files = mLayout == kReplicateCombined ? 1 : mnReplicates;
+      off_t size = rowBytes * mnRows * (files == 1 ? mnReplicates : 1);
+      for (uint32_t r = 0; r < files; r++)
       {
-        processArray(true);
+        int fd = open(outputName(aOutputfile, r).c_str(), flags, 0666);
+        if (fd < 0 || ftruncate(fd, size) != 0)
+          throw RuntimeException("Cannot open an output file.");
+        mReplicateFds.push_back(fd);
       }
-      fseek(mData, 0, SEEK_SET);
-      for (uint32_t i = 0; i < nGenes; i++)
-        mRankAvgs[i] /= mRankCounts[i];
+      return;
     }
-    while (fread(mBuf, sizeof(double), nGenes, mData) == nGenes)
+
+    // Unscrambled data and single replicates are written sequentially, as
+    // they always have been...
+    if (mnReplicates == 1)
+    {
+      mOutputFile = fopen(aOutputfile.c_str(), aAppend ? "a" : "w");
+      if (mOutputFile == NULL)
+        throw RuntimeException("Cannot open the output file.");
+      return;
+    }
+
+    // ... but replicates are written at explicit offsets, since several
+    // threads may be writing at once.
+    if (mLayout == kReplicateCombined)
     {
-      processArray();
+      int fd = open(aOutputfile.c_str(), flags, 0666);
+      if (fd < 0)
+        throw RuntimeException("Cannot open the output file.");
+      mReplicateFds.push_back(fd);
+      return;
     }
+
+    for (uint32_t r = 0; r < mnReplicates; r++)
+    {
+      int fd = open(outputName(aOutputfile, r).c_str(), flags, 0666);
+      if (fd < 0)
+        throw RuntimeException("Cannot open a replicate output file.");
+      mReplicateFds.push_back(fd);
+    }
+  }
+
+  static void
+  writeStats(const MatrixStats& aStats, const fs::path& aMatrixDir,
+             bool aUseInverse)
+  {
+    aStats.write(aMatrixDir.string(), aMatrixDir.string(), aUseInverse);
+    if (!aUseInverse)
+      aStats.save((aMatrixDir / MatrixStats::kSavedName).string());
   }
 
   void
-  processArray(bool aAverageMode = false)
+  processAllData()
   {
-    uint32_t nNotNans = 0;
+    if (mQuantileNormalisation && mPass == kUseRankAverages)
+      mRanker->readRankAverages(rankAveragesName(mOutputName));
+    else if (mQuantileNormalisation)
+    {
+      if (mPass == kRankSumsOnly)
+        mRanker->keepRankBlocks(mFirstRow / RowRanker::kRankBlockRows);
 
-    if (mScramble)
+      // Scrambling only moves values around within a row, so it cannot
+      // change the sorted values we are averaging here.
+      while ((mRow = mData->nextRow()) != NULL)
+      {
+        mRanker->accumulateRankAverages(mRow, *mWorkspaces[0]);
+      }
+
+      if (mPass == kRankSumsOnly)
+      {
+        mRanker->writeRankSums(rankSumsName(mOutputName, mShard.index()));
+        return;
+      }
+      mData->rewind();
+      mRanker->finishRankAverages();
+    }
+
+    if (mnReplicates == 1)
     {
-      boost::uniform_int<uint32_t> ui(0, nGenes - 1);
-      for (uint32_t k = 0; k < nGenes; k++)
+      for (mRowIndex = mFirstRow; (mRow = mData->nextRow()) != NULL;
+           mRowIndex++)
       {
-        double t = mBuf[k];
-        uint32_t h = ui(mRand);
-        
-        mBuf[k] = mBuf[h];
-        mBuf[h] = t;
+        processReplicate(*mWorkspaces[0], 0);
+        if (mStats != NULL)
+          mStats->addRow(mRow);
+        if (mOutputFile != NULL)
+          fwrite(mWorkspaces[0]->mRanks, sizeof(double), nGenes, mOutputFile);
+        else
+          writeReplicate(*mWorkspaces[0], 0);
       }
+      return;
     }
 
-    for (uint32_t i = 0; i < nGenes; i++)
+    // Each row is read once, and then every replicate of it is ranked while
+    // it is still in cache. The worker threads wait on mStartWork for the
+    // next row, and report back through mWorkDone.
+    boost::barrier startWork(mnThreads), workDone(mnThreads);
+    mStartWork = &startWork;
+    mWorkDone = &workDone;
+    mStopping = false;
+
+    boost::thread_group workers;
+    for (uint32_t t = 1; t < mnThreads; t++)
+      workers.create_thread(boost::bind(&RankTransformer::workerLoop, this, t));
+
+    for (mRowIndex = mFirstRow; (mRow = mData->nextRow()) != NULL;
+         mRowIndex++)
     {
-      mInvRanks[i] = i;
-      nNotNans += !!finite(mBuf[i]);
+      if (mnThreads > 1)
+        startWork.wait();
+      processReplicatesFor(0);
+      if (mStats != NULL)
+        mStats->addRow(mRow);
+      if (mnThreads > 1)
+        workDone.wait();
     }
 
-    double rankInflationFactor = (nGenes + 0.0) / nNotNans;
+    mStopping = true;
+    if (mnThreads > 1)
+      startWork.wait();
+    workers.join_all();
+    mStartWork = mWorkDone = NULL;
+  }
 
-    // Sort indices by value, with NaNs at the top.
-    std::sort(mInvRanks, mInvRanks + nGenes,
-              (bll::var(mBuf)[bll::_1] < bll::var(mBuf)[bll::_2]) ||
-              (bll::bind(finite, bll::var(mBuf)[bll::_1]) &&
-               !bll::bind(finite, bll::var(mBuf)[bll::_2])));
-    
-    uint32_t i;
-    if (aAverageMode)
+  void
+  workerLoop(uint32_t aThread)
+  {
+    while (true)
     {
-      for (i = 0; i < nGenes && finite(mBuf[mInvRanks[i]]); i++)
-      {
-        mRankAvgs[i] += mBuf[mInvRanks[i]];
-        mRankCounts[i]++;
-      }
+      mStartWork->wait();
+      if (mStopping)
+        return;
+      processReplicatesFor(aThread);
+      mWorkDone->wait();
     }
-    else
+  }
+
+  void
+  processReplicatesFor(uint32_t aThread)
+  {
+    RankWorkspace& ws = *mWorkspaces[aThread];
+    for (uint32_t r = aThread; r < mnReplicates; r += mnThreads)
     {
-      if (mQuantileNormalisation)
-      {
-        for (i = 0; i < nGenes && finite(mBuf[mInvRanks[i]]); i++)
-          // We could put code in here to deal with tied ranks by putting in median
-          // ranks, but I doubt it would make enough difference to justify it.
-          mRanks[mInvRanks[i]] = mRankAvgs[i];
-      }
-      else
-      {
-        for (i = 0; i < nGenes && finite(mBuf[mInvRanks[i]]); i++)
-          // We could put code in here to deal with tied ranks by putting in median
-          // ranks, but I doubt it would make enough difference to justify it.
-          mRanks[mInvRanks[i]] = i * rankInflationFactor;
-      }
+      processReplicate(ws, r);
+      writeReplicate(ws, r);
+    }
+  }
 
-      for (; i < nGenes; i++)
-        mRanks[mInvRanks[i]] = std::numeric_limits<double>::quiet_NaN();
+  void
+  writeReplicate(RankWorkspace& aWS, uint32_t aReplicate)
+  {
+    uint64_t row = mRowIndex;
+    int fd;
+    if (mLayout == kReplicateCombined)
+    {
+      row += static_cast<uint64_t>(aReplicate) * mnRows;
+      fd = mReplicateFds[0];
+    }
+    else
+      fd = mReplicateFds[aReplicate];
+
+    size_t len = sizeof(double) * nGenes;
+    if (pwrite(fd, aWS.mRanks, len, row * len) != static_cast<ssize_t>(len))
+    {
+      if (!mWriteFailed)
+        std::cerr << "Failed to write replicate " << aReplicate << " row "
+                  << mRowIndex << std::endl;
+      mWriteFailed = true;
+    }
+  }
 
-      fwrite(mRanks, sizeof(double), nGenes, mOutputFile);
+  void
+  processReplicate(RankWorkspace& aWS, uint32_t aReplicate)
+  {
+    if (mScramble)
+    {
+      PhiloxStream rng(mSeed, aReplicate, mRowIndex);
+      mRanker->rankRow(mRow, aWS, &rng);
     }
+    else
+      mRanker->rankRow(mRow, aWS);
   }
 };
 
 int
 main(int argc, char** argv)
 {
-  std::string matrixdir, outputfile;
+  std::string matrixdir, outputfile, layout("files"), shard, profile;
+  uint32_t replicates = 1, threads = 1, localShards = 0, mergeShards = 0,
+    mergeStatsShards = 0, progress = 0;
+  uint64_t seed = 0;
   po::options_description desc;
 
   desc.add_options()
     ("matrixdir", po::value<std::string>(&matrixdir), "The directory to read the data from")
     ("use_inverse", "Use the inverted data-set instead of the original")
     ("scramble", "Scramble data prior to rank transform")
+    ("replicates", po::value<uint32_t>(&replicates),
+     "With --scramble, the number of scrambled replicates to make from each "
+     "row read (default 1)")
+    ("seed", po::value<uint64_t>(&seed),
+     "With --scramble, the seed for the replicate random streams (default 0)")
+    ("replicate_layout", po::value<std::string>(&layout),
+     "With --replicates, 'files' to write <output>.<n> for each replicate, or "
+     "'combined' to write every replicate in turn into the output file")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of threads to rank replicates on (default 1)")
     ("output", po::value<std::string>(&outputfile), "The file to write the output into")
     ("qnorm", "If specified, causes quantile normalisation to be applied to the data")
+    ("append", "Only rank the rows of data past the end of the existing "
+     "output, and add them to it")
+    ("shard", po::value<std::string>(&shard),
+     "Only rank shard i of N of the rows, given as i/N, into their place in "
+     "the output")
+    ("rank_sums_only", "With --qnorm and --shard, only add up the shard's "
+     "rank sums, into <output>.rank_sums.<i>")
+    ("merge_rank_sums", po::value<uint32_t>(&mergeShards),
+     "Add up the rank sums from this many shards into "
+     "<output>.rank_averages")
+    ("merge_stats", po::value<uint32_t>(&mergeStatsShards),
+     "Merge the statistics that this many shards run with --stats saved "
+     "into <output>.stats_state.<i>, and write them")
+    ("rank_averages", "With --qnorm and --shard, rank using "
+     "<output>.rank_averages")
+    ("local_shards", po::value<uint32_t>(&localShards),
+     "Run this many shards at once on this machine, including the rank sums "
+     "passes for --qnorm")
     ;
+  desc.add(MatrixStats::options("matrixdir, from the rows as they are "
+                                "read"));
+  desc.add(Profile::options(profile, progress));
 
   po::variables_map vm;
 
@@ -240,6 +558,139 @@ main(int argc, char** argv)
     return 1;
   }
 
-  RankTransformer rt(matrixdir, outputfile, vm.count("qnorm") != 0, vm.count("use_inverse") != 0,
-                     vm.count("scramble") != 0);
+  RankTransformer::ReplicateLayout rl;
+  if (layout == "files")
+    rl = RankTransformer::kReplicateFiles;
+  else if (layout == "combined")
+    rl = RankTransformer::kReplicateCombined;
+  else
+  {
+    std::cerr << "Invalid replicate layout supplied" << std::endl;
+    return 1;
+  }
+
+  if (replicates == 0)
+  {
+    std::cerr << "At least one replicate is needed" << std::endl;
+    return 1;
+  }
+
+  // Quantile normalisation and ranks across arrays both change every
+  // existing row when rows are added, and the combined layout puts each
+  // replicate at an offset that depends on the number of rows, so none of
+  // those can be extended.
+  if (vm.count("append") &&
+      (vm.count("qnorm") || vm.count("use_inverse") ||
+       (replicates > 1 && rl == RankTransformer::kReplicateCombined)))
+  {
+    std::cerr << "--append cannot be used with --qnorm, --use_inverse or "
+      "the combined replicate layout" << std::endl;
+    return 1;
+  }
+
+  bool sharded = vm.count("shard") || localShards > 1;
+  if (vm.count("append") && sharded)
+  {
+    std::cerr << "--append cannot be used with shards" << std::endl;
+    return 1;
+  }
+
+  // Each shard only sees its own rows, so quantile normalisation has to be
+  // done in two passes, with the rank sums merged in between.
+  RankTransformer::RankAveragesPass pass = RankTransformer::kComputeRankAverages;
+  if (vm.count("rank_sums_only"))
+    pass = RankTransformer::kRankSumsOnly;
+  else if (vm.count("rank_averages"))
+    pass = RankTransformer::kUseRankAverages;
+  if (vm.count("shard") && vm.count("qnorm") &&
+      pass == RankTransformer::kComputeRankAverages)
+  {
+    std::cerr << "--shard with --qnorm needs --rank_sums_only or "
+      "--rank_averages" << std::endl;
+    return 1;
+  }
+  if (pass != RankTransformer::kComputeRankAverages && !vm.count("qnorm"))
+  {
+    std::cerr << "--rank_sums_only and --rank_averages need --qnorm"
+              << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    if (vm.count("merge_rank_sums"))
+    {
+      RankTransformer::mergeRankSums(matrixdir, outputfile,
+                                     vm.count("use_inverse") != 0,
+                                     mergeShards);
+      return 0;
+    }
+
+    if (vm.count("merge_stats"))
+    {
+      RankTransformer::mergeStats(matrixdir, outputfile,
+                                  vm.count("use_inverse") != 0,
+                                  mergeStatsShards);
+      return 0;
+    }
+
+    if (localShards > 1)
+    {
+      bool ok;
+      if (!vm.count("qnorm"))
+        ok = runLocalShards(argc, argv, localShards);
+      else
+      {
+        std::vector<std::string> sumsPass(1, "--rank_sums_only"),
+          rankPass(1, "--rank_averages");
+        if (!runLocalShards(argc, argv, localShards, sumsPass))
+          return 1;
+        RankTransformer::mergeRankSums(matrixdir, outputfile,
+                                       vm.count("use_inverse") != 0,
+                                       localShards);
+        for (uint32_t s = 0; s < localShards; s++)
+          fs::remove(RankTransformer::rankSumsName(outputfile, s));
+        ok = runLocalShards(argc, argv, localShards, rankPass);
+        fs::remove(RankTransformer::rankAveragesName(outputfile));
+      }
+
+      if (ok && vm.count("stats"))
+        RankTransformer::mergeStats(matrixdir, outputfile,
+                                    vm.count("use_inverse") != 0,
+                                    localShards);
+      if (vm.count("stats"))
+        for (uint32_t s = 0; s < localShards; s++)
+          fs::remove(RankTransformer::statsName(outputfile, s));
+      return ok ? 0 : 1;
+    }
+
+    // Each shard reports on itself, into a file of its own.
+    std::string tool("RankTransformDataset");
+    if (vm.count("shard"))
+    {
+      tool += " " + shard;
+      if (profile != "")
+        profile += "." + boost::lexical_cast<std::string>(Shard(shard).index());
+    }
+    if (profile != "")
+      Profile::enable();
+    ScopedProgress progressLine(tool, progress);
+
+    {
+      RankTransformer rt(matrixdir, outputfile, vm.count("qnorm") != 0,
+                         vm.count("use_inverse") != 0,
+                         vm.count("scramble") != 0, replicates, seed, rl,
+                         threads, vm.count("append") != 0,
+                         vm.count("shard") ? Shard(shard) : Shard(), pass,
+                         vm.count("stats") != 0);
+    }
+
+    if (profile != "")
+      Profile::writeReport(profile, tool);
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
 }
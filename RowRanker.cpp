@@ -0,0 +1,278 @@
+/*
+    RowRanker: Rank transform or quantile normalise rows of a matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "RowRanker.hpp"
+#include "RuntimeException.hpp"
+#include <boost/lambda/lambda.hpp>
+#include <boost/lambda/bind.hpp>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+
+namespace bll = boost::lambda;
+
+RowRanker::RowRanker(uint32_t aGenes, bool aQuantileNormalisation)
+  : nGenes(aGenes), mQuantileNormalisation(aQuantileNormalisation),
+    mRankAvgs(NULL), mRankCounts(NULL), mBlockSums(NULL), mBlockFill(0),
+    mKeepBlocks(false), mFirstBlock(0), mNextBlock(0),
+    mRowsRanked(Profile::counter("rows_ranked")),
+    mSortTimer(Profile::timer("row_sort"))
+{
+  if (mQuantileNormalisation)
+  {
+    mRankAvgs = new double[nGenes];
+    mRankCounts = new uint32_t[nGenes];
+    mBlockSums = new double[nGenes];
+    memset(mRankAvgs, 0, sizeof(double) * nGenes);
+    memset(mRankCounts, 0, sizeof(uint32_t) * nGenes);
+    memset(mBlockSums, 0, sizeof(double) * nGenes);
+  }
+}
+
+RowRanker::~RowRanker()
+{
+  if (mBlockSums != NULL)
+    delete [] mBlockSums;
+  if (mRankCounts != NULL)
+    delete [] mRankCounts;
+  if (mRankAvgs != NULL)
+    delete [] mRankAvgs;
+}
+
+// Sorts indices by value, with NaNs at the top, and returns the number of
+// values that are not NaN.
+uint32_t
+RowRanker::sortArray(const double* buf, RankWorkspace& aWS)
+{
+  uint32_t nNotNans = 0;
+  uint32_t* invRanks = aWS.mInvRanks;
+  ScopedProfileTimer timer(mSortTimer);
+
+  for (uint32_t i = 0; i < nGenes; i++)
+  {
+    invRanks[i] = i;
+    nNotNans += !!finite(buf[i]);
+  }
+
+  std::sort(invRanks, invRanks + nGenes,
+            (bll::var(buf)[bll::_1] < bll::var(buf)[bll::_2]) ||
+            (bll::bind(finite, bll::var(buf)[bll::_1]) &&
+             !bll::bind(finite, bll::var(buf)[bll::_2])));
+
+  return nNotNans;
+}
+
+void
+RowRanker::accumulateRankAverages(const double* aRow, RankWorkspace& aWS)
+{
+  sortArray(aRow, aWS);
+
+  for (uint32_t i = 0; i < nGenes && finite(aRow[aWS.mInvRanks[i]]); i++)
+  {
+    mBlockSums[i] += aRow[aWS.mInvRanks[i]];
+    mRankCounts[i]++;
+  }
+
+  if (++mBlockFill == kRankBlockRows)
+    endRankBlock();
+}
+
+// Block sums are added into the totals in block order, just as
+// addRankSums() adds them, so that the order of the additions does not
+// depend on how the rows were split.
+void
+RowRanker::endRankBlock()
+{
+  if (mKeepBlocks)
+    mKeptBlocks.insert(mKeptBlocks.end(), mBlockSums, mBlockSums + nGenes);
+  else
+    for (uint32_t i = 0; i < nGenes; i++)
+      mRankAvgs[i] += mBlockSums[i];
+
+  memset(mBlockSums, 0, sizeof(double) * nGenes);
+  mBlockFill = 0;
+}
+
+void
+RowRanker::finishRankAverages()
+{
+  if (mBlockFill != 0)
+    endRankBlock();
+
+  for (uint32_t i = 0; i < nGenes; i++)
+    mRankAvgs[i] /= mRankCounts[i];
+}
+
+// A rank sums file is a RankSumsHeader, then the counts for each rank, then
+// the sums for each block in turn.
+struct RankSumsHeader
+{
+  char mMagic[8];
+  uint32_t mGenes, mFirstBlock, mBlocks;
+};
+
+static const char kRankSumsMagic[8] = { 'R', 'A', 'N', 'K', 'S', 'U', 'M', '1' };
+
+void
+RowRanker::keepRankBlocks(uint32_t aFirstBlock)
+{
+  mKeepBlocks = true;
+  mFirstBlock = aFirstBlock;
+}
+
+void
+RowRanker::writeRankSums(const std::string& aPath)
+{
+  if (mBlockFill != 0)
+    endRankBlock();
+
+  RankSumsHeader h;
+  memcpy(h.mMagic, kRankSumsMagic, sizeof(h.mMagic));
+  h.mGenes = nGenes;
+  h.mFirstBlock = mFirstBlock;
+  h.mBlocks = mKeptBlocks.size() / (nGenes == 0 ? 1 : nGenes);
+
+  FILE* f = fopen(aPath.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the rank sums file.");
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+    fwrite(mRankCounts, sizeof(uint32_t), nGenes, f) == nGenes;
+  if (ok && !mKeptBlocks.empty())
+    ok = fwrite(&mKeptBlocks[0], sizeof(double), mKeptBlocks.size(), f) ==
+      mKeptBlocks.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+    throw RuntimeException("Failed to write the rank sums file.");
+}
+
+void
+RowRanker::addRankSums(const std::string& aPath)
+{
+  FILE* f = fopen(aPath.c_str(), "r");
+  if (f == NULL)
+    throw RuntimeException("Cannot open a rank sums file.");
+
+  RankSumsHeader h;
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.mMagic, kRankSumsMagic, sizeof(h.mMagic)) != 0 ||
+      h.mGenes != nGenes)
+  {
+    fclose(f);
+    throw RuntimeException("A rank sums file is not for this matrix.");
+  }
+  if (h.mFirstBlock != mNextBlock)
+  {
+    fclose(f);
+    throw RuntimeException("The rank sums files do not follow on from each "
+                           "other.");
+  }
+
+  std::vector<uint32_t> counts(nGenes);
+  bool ok = nGenes == 0 ||
+    fread(&counts[0], sizeof(uint32_t), nGenes, f) == nGenes;
+  for (uint32_t i = 0; i < nGenes; i++)
+    mRankCounts[i] += counts[i];
+
+  for (uint32_t b = 0; ok && b < h.mBlocks; b++)
+  {
+    ok = fread(mBlockSums, sizeof(double), nGenes, f) == nGenes;
+    if (ok)
+      for (uint32_t i = 0; i < nGenes; i++)
+        mRankAvgs[i] += mBlockSums[i];
+  }
+  fclose(f);
+  memset(mBlockSums, 0, sizeof(double) * nGenes);
+  if (!ok)
+    throw RuntimeException("A rank sums file is truncated.");
+
+  mNextBlock += h.mBlocks;
+}
+
+void
+RowRanker::writeRankAverages(const std::string& aPath) const
+{
+  FILE* f = fopen(aPath.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the rank averages file.");
+  bool ok = fwrite(mRankAvgs, sizeof(double), nGenes, f) == nGenes;
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+    throw RuntimeException("Failed to write the rank averages file.");
+}
+
+void
+RowRanker::readRankAverages(const std::string& aPath)
+{
+  FILE* f = fopen(aPath.c_str(), "r");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the rank averages file.");
+  bool ok = fread(mRankAvgs, sizeof(double), nGenes, f) == nGenes &&
+    fgetc(f) == EOF;
+  fclose(f);
+  if (!ok)
+    throw RuntimeException("The rank averages file is not for this matrix.");
+}
+
+void
+RowRanker::rankRow(const double* aRow, RankWorkspace& aWS,
+                   PhiloxStream* aShuffle)
+{
+  // The row is only copied when it has to be shuffled; otherwise we rank
+  // it where it is.
+  const double* buf = aRow;
+
+  if (aShuffle != NULL)
+  {
+    double* sbuf = aWS.mBuf;
+    memcpy(sbuf, aRow, sizeof(double) * nGenes);
+    // Fisher-Yates shuffle, drawing from this row's own stream.
+    for (uint32_t k = nGenes; k > 1; k--)
+    {
+      uint32_t h = aShuffle->below(k);
+      double t = sbuf[k - 1];
+      sbuf[k - 1] = sbuf[h];
+      sbuf[h] = t;
+    }
+    buf = sbuf;
+  }
+
+  uint32_t nNotNans = sortArray(buf, aWS);
+  mRowsRanked.add();
+  double rankInflationFactor = (nGenes + 0.0) / nNotNans;
+  const uint32_t* invRanks = aWS.mInvRanks;
+  double* ranks = aWS.mRanks;
+
+  uint32_t i;
+  if (mQuantileNormalisation)
+  {
+    for (i = 0; i < nGenes && finite(buf[invRanks[i]]); i++)
+      // We could put code in here to deal with tied ranks by putting in median
+      // ranks, but I doubt it would make enough difference to justify it.
+      ranks[invRanks[i]] = mRankAvgs[i];
+  }
+  else
+  {
+    for (i = 0; i < nGenes && finite(buf[invRanks[i]]); i++)
+      // We could put code in here to deal with tied ranks by putting in median
+      // ranks, but I doubt it would make enough difference to justify it.
+      ranks[invRanks[i]] = i * rankInflationFactor;
+  }
+
+  for (; i < nGenes; i++)
+    ranks[invRanks[i]] = std::numeric_limits<double>::quiet_NaN();
+}
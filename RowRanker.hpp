@@ -0,0 +1,188 @@
+/*
+    RowRanker: Rank transform or quantile normalise rows of a matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ROW_RANKER_HPP
+#define ROW_RANKER_HPP
+
+#include "Profile.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A Philox4x32-10 counter-based generator. Every (seed, replicate, row)
+// triple names its own stream, so the permutation applied to a row does not
+// depend on how many threads there are or on which thread does the work.
+class PhiloxStream
+{
+public:
+  PhiloxStream(uint64_t aSeed, uint32_t aReplicate, uint32_t aRow)
+    : mBlock(0), mReplicate(aReplicate), mRow(aRow), mAvailable(0)
+  {
+    mKey[0] = static_cast<uint32_t>(aSeed);
+    mKey[1] = static_cast<uint32_t>(aSeed >> 32);
+  }
+
+  uint32_t
+  next()
+  {
+    if (mAvailable == 0)
+      refill();
+    return mOut[--mAvailable];
+  }
+
+  // Returns a uniformly distributed integer in [0, aBound), using Lemire's
+  // multiply-and-reject method.
+  uint32_t
+  below(uint32_t aBound)
+  {
+    uint64_t m = static_cast<uint64_t>(next()) * aBound;
+    uint32_t l = static_cast<uint32_t>(m);
+    if (l < aBound)
+    {
+      uint32_t t = (0u - aBound) % aBound;
+      while (l < t)
+      {
+        m = static_cast<uint64_t>(next()) * aBound;
+        l = static_cast<uint32_t>(m);
+      }
+    }
+    return static_cast<uint32_t>(m >> 32);
+  }
+
+private:
+  uint32_t mKey[2], mOut[4];
+  uint32_t mBlock, mReplicate, mRow, mAvailable;
+
+  void
+  refill()
+  {
+    uint32_t c[4] = { mBlock++, mRow, mReplicate, 0 };
+    uint32_t k0 = mKey[0], k1 = mKey[1];
+    for (uint32_t round = 0; round < 10; round++)
+    {
+      if (round != 0)
+      {
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+      }
+      uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c[0];
+      uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c[2];
+      uint32_t hi0 = p0 >> 32, lo0 = static_cast<uint32_t>(p0);
+      uint32_t hi1 = p1 >> 32, lo1 = static_cast<uint32_t>(p1);
+      c[0] = hi1 ^ c[1] ^ k0;
+      c[1] = lo1;
+      c[2] = hi0 ^ c[3] ^ k1;
+      c[3] = lo0;
+    }
+    memcpy(mOut, c, sizeof(mOut));
+    mAvailable = 4;
+  }
+};
+
+// Scratch space for ranking one row. Each worker thread owns one, so that
+// rows (or replicates of a row) can be ranked concurrently.
+struct RankWorkspace
+{
+  RankWorkspace(uint32_t aN)
+    : mBuf(new double[aN]), mRanks(new double[aN]),
+      mInvRanks(new uint32_t[aN])
+  {
+  }
+
+  ~RankWorkspace()
+  {
+    delete [] mBuf;
+    delete [] mRanks;
+    delete [] mInvRanks;
+  }
+
+  double* mBuf, * mRanks;
+  uint32_t* mInvRanks;
+};
+
+// Ranks rows of nGenes values. For quantile normalisation, every row must
+// first be passed to accumulateRankAverages(), then finishRankAverages()
+// called, before any row is ranked. rankRow() only reads the shared state,
+// so it may be called from several threads with their own workspaces.
+//
+// The rank sums are added up kRankBlockRows rows at a time, and the block
+// sums added together in block order. Rows can then be split between
+// processes on block boundaries: each keeps its block sums with
+// keepRankBlocks() and writes them out with writeRankSums(), and adding
+// those back up in order with addRankSums() gives exactly the averages one
+// process would have.
+class RowRanker
+{
+public:
+  RowRanker(uint32_t aGenes, bool aQuantileNormalisation);
+  ~RowRanker();
+
+  void accumulateRankAverages(const double* aRow, RankWorkspace& aWS);
+  void finishRankAverages();
+
+  // Keeps each block's sums rather than adding them up, for
+  // writeRankSums(). aFirstBlock is the index of the first block to be
+  // accumulated.
+  void keepRankBlocks(uint32_t aFirstBlock);
+  void writeRankSums(const std::string& aPath);
+
+  // Adds in the block sums from a file written by writeRankSums(). The
+  // files must be added in block order, with none missing.
+  void addRankSums(const std::string& aPath);
+
+  // The averages that finishRankAverages() arrived at, so that other
+  // processes can rank rows with them without the accumulating pass.
+  void writeRankAverages(const std::string& aPath) const;
+  void readRankAverages(const std::string& aPath);
+
+  // Puts the ranks of aRow into aWS.mRanks. If aShuffle is given, the row is
+  // first copied into aWS.mBuf and shuffled using it.
+  void rankRow(const double* aRow, RankWorkspace& aWS,
+               PhiloxStream* aShuffle = NULL);
+
+  uint32_t
+  genes() const
+  {
+    return nGenes;
+  }
+
+  static const uint32_t kRankBlockRows = 4096;
+
+private:
+  uint32_t nGenes;
+  bool mQuantileNormalisation;
+  double * mRankAvgs;
+  uint32_t * mRankCounts;
+
+  // The sums for the block being accumulated, and the number of rows in it.
+  double* mBlockSums;
+  uint32_t mBlockFill;
+
+  // The block sums kept for writeRankSums(), and the index of the next
+  // block expected by addRankSums().
+  bool mKeepBlocks;
+  uint32_t mFirstBlock, mNextBlock;
+  std::vector<double> mKeptBlocks;
+  ProfileCounter& mRowsRanked;
+  ProfileTimer& mSortTimer;
+
+  uint32_t sortArray(const double* buf, RankWorkspace& aWS);
+  void endRankBlock();
+};
+
+#endif // ROW_RANKER_HPP
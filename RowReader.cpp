@@ -0,0 +1,237 @@
+/*
+    RowReader: Read rows of a binary matrix ahead of their use.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "RowReader.hpp"
+#include "RuntimeException.hpp"
+#include <boost/bind.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+RowReader::RowReader(const std::string& aPath, uint32_t aRowLength,
+                     uint32_t aRowsPerBlock, uint32_t aBlocks,
+                     uint64_t aFirstRow, uint64_t aEndRow)
+  : mFd(-1), mRowLength(aRowLength), mRowsPerBlock(aRowsPerBlock),
+    mnSlots(aBlocks), mFirstRow(aFirstRow), mnRows(0), mSlots(NULL),
+    mCurrentSlot(0), mCurrentRow(0), mHaveCurrent(false), mBlocksConsumed(0),
+    mProducer(NULL), mStopping(false), mFailed(false),
+    mBytesRead(Profile::counter("bytes_read")),
+    mReadWait(Profile::timer("row_read_wait"))
+{
+  mFd = open(aPath.c_str(), O_RDONLY);
+  if (mFd < 0)
+    throw RuntimeException("Cannot open the data file.");
+
+  struct stat st;
+  if (fstat(mFd, &st) != 0)
+  {
+    close(mFd);
+    throw RuntimeException("Cannot stat the data file.");
+  }
+
+  uint64_t rowBytes = static_cast<uint64_t>(mRowLength) * sizeof(double);
+  if (rowBytes != 0)
+  {
+    uint64_t fileRows = st.st_size / rowBytes;
+    if (aEndRow > fileRows)
+      aEndRow = fileRows;
+    if (aEndRow > mFirstRow)
+      mnRows = aEndRow - mFirstRow;
+  }
+
+  if (mRowsPerBlock == 0)
+  {
+    mRowsPerBlock = rowBytes == 0 ? 1 : kDefaultBlockBytes / rowBytes;
+    if (mRowsPerBlock == 0)
+      mRowsPerBlock = 1;
+  }
+  if (mnSlots < 2)
+    mnSlots = 2;
+
+  posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  mSlots = new Slot[mnSlots];
+  for (uint32_t i = 0; i < mnSlots; i++)
+  {
+    mSlots[i].mData = new double[static_cast<uint64_t>(mRowsPerBlock) *
+                                 mRowLength];
+    mSlots[i].mRows = 0;
+    mSlots[i].mFull = false;
+  }
+
+  start();
+}
+
+RowReader::~RowReader()
+{
+  stop();
+  for (uint32_t i = 0; i < mnSlots; i++)
+    delete [] mSlots[i].mData;
+  delete [] mSlots;
+  close(mFd);
+}
+
+const double*
+RowReader::nextRow()
+{
+  if (mHaveCurrent && mCurrentRow == mSlots[mCurrentSlot].mRows)
+    releaseCurrent();
+  if (!mHaveCurrent && !acquireNext())
+    return NULL;
+
+  return mSlots[mCurrentSlot].mData +
+    static_cast<uint64_t>(mCurrentRow++) * mRowLength;
+}
+
+const double*
+RowReader::nextBlock(uint32_t& aRows)
+{
+  if (mHaveCurrent && mCurrentRow == mSlots[mCurrentSlot].mRows)
+    releaseCurrent();
+  if (!mHaveCurrent && !acquireNext())
+  {
+    aRows = 0;
+    return NULL;
+  }
+
+  Slot& s = mSlots[mCurrentSlot];
+  const double* p = s.mData + static_cast<uint64_t>(mCurrentRow) * mRowLength;
+  aRows = s.mRows - mCurrentRow;
+  mCurrentRow = s.mRows;
+  return p;
+}
+
+void
+RowReader::rewind()
+{
+  stop();
+  for (uint32_t i = 0; i < mnSlots; i++)
+    mSlots[i].mFull = false;
+  mHaveCurrent = false;
+  mCurrentRow = 0;
+  mBlocksConsumed = 0;
+  start();
+}
+
+void
+RowReader::start()
+{
+  mStopping = false;
+  mFailed = false;
+  mProducer = new boost::thread(boost::bind(&RowReader::produce, this));
+}
+
+void
+RowReader::stop()
+{
+  if (mProducer == NULL)
+    return;
+
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mStopping = true;
+  }
+  mSlotEmptied.notify_all();
+  mProducer->join();
+  delete mProducer;
+  mProducer = NULL;
+}
+
+void
+RowReader::produce()
+{
+  uint64_t rowBytes = static_cast<uint64_t>(mRowLength) * sizeof(double);
+  uint64_t row0 = 0;
+
+  for (uint64_t block = 0; row0 < mnRows; block++)
+  {
+    Slot& s = mSlots[block % mnSlots];
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      while (s.mFull && !mStopping)
+        mSlotEmptied.wait(lock);
+      if (mStopping)
+        return;
+    }
+
+    uint64_t rows = mnRows - row0;
+    if (rows > mRowsPerBlock)
+      rows = mRowsPerBlock;
+
+    // The slot is ours until we mark it as full, so read without the lock.
+    char* p = reinterpret_cast<char*>(s.mData);
+    uint64_t want = rows * rowBytes, got = 0;
+    off_t offset = (mFirstRow + row0) * rowBytes;
+    while (got < want)
+    {
+      ssize_t n = pread(mFd, p + got, want - got, offset + got);
+      if (n <= 0)
+        break;
+      got += n;
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if (got != want)
+    {
+      mFailed = true;
+      mSlotFilled.notify_all();
+      return;
+    }
+    s.mRows = rows;
+    s.mFull = true;
+    mBytesRead.add(want);
+    mSlotFilled.notify_all();
+    row0 += rows;
+  }
+}
+
+bool
+RowReader::acquireNext()
+{
+  uint64_t blocks = (mnRows + mRowsPerBlock - 1) / mRowsPerBlock;
+  if (mBlocksConsumed == blocks)
+    return false;
+
+  mCurrentSlot = mBlocksConsumed % mnSlots;
+  Slot& s = mSlots[mCurrentSlot];
+  boost::mutex::scoped_lock lock(mMutex);
+  if (!s.mFull && !mFailed)
+  {
+    // Only time the waits, which are when reading is the bottleneck.
+    ScopedProfileTimer timer(mReadWait);
+    while (!s.mFull && !mFailed)
+      mSlotFilled.wait(lock);
+  }
+  if (!s.mFull)
+    throw RuntimeException("data file could not be read.");
+
+  mHaveCurrent = true;
+  mCurrentRow = 0;
+  return true;
+}
+
+void
+RowReader::releaseCurrent()
+{
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mSlots[mCurrentSlot].mFull = false;
+  }
+  mSlotEmptied.notify_all();
+  mHaveCurrent = false;
+  mBlocksConsumed++;
+}
@@ -0,0 +1,97 @@
+/*
+    RowReader: Read rows of a binary matrix ahead of their use.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ROW_READER_HPP
+#define ROW_READER_HPP
+
+#include "Profile.hpp"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <string>
+#include <stdint.h>
+
+// Reads a file of fixed-length rows of doubles in multi-row blocks on a
+// background thread, into a ring of buffers, so that the caller can work on
+// one block while the next ones are being read. Rows are handed out as
+// pointers into the ring, and are only valid until the block they are in has
+// been finished with (that is, until a row or block past it is requested).
+class RowReader
+{
+public:
+  // aRowsPerBlock of 0 picks a block of around kDefaultBlockBytes. Only rows
+  // [aFirstRow, aEndRow) of the file are read; rows past the end of the file
+  // are left out.
+  RowReader(const std::string& aPath, uint32_t aRowLength,
+            uint32_t aRowsPerBlock = 0, uint32_t aBlocks = 3,
+            uint64_t aFirstRow = 0, uint64_t aEndRow = kAllRows);
+  ~RowReader();
+
+  // The next row, or NULL once every complete row has been read.
+  const double* nextRow();
+
+  // The rest of the current block, or the next block if the current one is
+  // used up, setting aRows to the number of rows in it. NULL at the end.
+  const double* nextBlock(uint32_t& aRows);
+
+  // Start reading again from the first row.
+  void rewind();
+
+  // The number of rows that will be read.
+  uint64_t
+  rowCount() const
+  {
+    return mnRows;
+  }
+
+  static const uint64_t kDefaultBlockBytes = 16 << 20;
+  static const uint64_t kAllRows = ~static_cast<uint64_t>(0);
+
+private:
+  struct Slot
+  {
+    double* mData;
+    uint32_t mRows;
+    bool mFull;
+  };
+
+  int mFd;
+  uint32_t mRowLength, mRowsPerBlock, mnSlots;
+  uint64_t mFirstRow, mnRows;
+  Slot* mSlots;
+
+  // Consumer side: the slot being handed out, and how far into it we are.
+  uint32_t mCurrentSlot, mCurrentRow;
+  bool mHaveCurrent;
+  uint64_t mBlocksConsumed;
+
+  // Producer side.
+  boost::mutex mMutex;
+  boost::condition_variable mSlotFilled, mSlotEmptied;
+  boost::thread* mProducer;
+  bool mStopping, mFailed;
+  ProfileCounter& mBytesRead;
+  ProfileTimer& mReadWait;
+
+  void start();
+  void stop();
+  void produce();
+  bool acquireNext();
+  void releaseCurrent();
+};
+
+#endif // ROW_READER_HPP
@@ -0,0 +1,40 @@
+/*
+    RuntimeException: The exception thrown when the matrix tools hit an error.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RUNTIME_EXCEPTION_HPP
+#define RUNTIME_EXCEPTION_HPP
+
+#include <string>
+
+class RuntimeException
+{
+public:
+  RuntimeException(const char* aWhy)
+    : mWhy(aWhy)
+  {
+  }
+
+  const std::string what()
+  {
+    return mWhy;
+  }
+
+private:
+  const char* mWhy;
+};
+
+#endif // RUNTIME_EXCEPTION_HPP
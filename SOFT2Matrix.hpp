@@ -0,0 +1,864 @@
+/*
+    SOFT2Matrix: Convert from the SOFT format to a packed binary matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SOFT2MATRIX_HPP
+#define SOFT2MATRIX_HPP
+
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <cstdio>
+#include <math.h>
+#include <boost/regex.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lambda/lambda.hpp>
+#include <boost/lambda/bind.hpp>
+#include <boost/lambda/construct.hpp>
+#include <unistd.h>
+#include "HGNCDatabase.hpp"
+#include "Matrix.hpp"
+#include "MatrixStats.hpp"
+#include "Profile.hpp"
+#include "RuntimeException.hpp"
+#include "SOFTInput.hpp"
+#include "StringArena.hpp"
+
+namespace fs = boost::filesystem;
+namespace bll = boost::lambda;
+
+// Receives each gene-level row (one per sample) as SOFT2Matrix produces it,
+// so that later stages can work on the matrix without reading it back from
+// disk.
+class GeneRowSink
+{
+public:
+  virtual ~GeneRowSink()
+  {
+  }
+
+  // Called once the platform table has been read and the size of the matrix
+  // is known.
+  virtual void beginMatrix(uint32_t aSamples, uint32_t aGenes) = 0;
+
+  // aGenes holds one value per gene, and is only valid during the call.
+  virtual void geneRow(const double* aGenes) = 0;
+};
+
+// With aAppend, an existing matrix in aOutdir is extended rather than
+// replaced: samples already listed in its arrays file are skipped without
+// being parsed, and the rows for the rest are added to the end of its data.
+// The platform must map to exactly the genes the matrix already has.
+//
+// While data is being written, a checkpoint recording how far through the
+// input we are and how much of data is complete is kept in the output
+// directory, so that an interrupted run can be picked up again with
+// resumeFromCheckpoint().
+class SOFT2Matrix
+{
+public:
+  SOFT2Matrix(SOFTInput& aSOFTFile, const std::string& aOutdir,
+              GeneRowSink* aSink = NULL, bool aWriteData = true,
+              bool aAppend = false)
+    : mOutdir(aOutdir), mSOFTFile(aSOFTFile), mArrayList(NULL),
+      mGeneList(NULL), mDataFile(NULL), mSink(aSink), mnSamples(0),
+      mNextSample(0), mProbesets(NULL), mGenes(NULL),
+      mGeneProbesetCounts(NULL), mGotSampleTable(true), mSkippingSample(false),
+      mAppend(false), mWriteData(aWriteData), mExistingRows(0),
+      mResuming(false), mInputOffset(0),
+      mSamplesSeen(0), mRowsWritten(0),
+      mCheckpointInterval(kDefaultCheckpointInterval),
+      mSamplesSinceCheckpoint(0),
+      mBytesParsed(Profile::counter("bytes_parsed")),
+      mLinesParsed(Profile::counter("lines_parsed")),
+      mSamplesProcessed(Profile::counter("samples_processed")),
+      mUnknownProbeIds(Profile::counter("unknown_probe_ids")),
+      mNaNGenes(Profile::counter("nan_filled_genes")),
+      mGatherStats(false), mStats(NULL),
+      mProbesetCount(0)
+  {
+    fs::path arrayList(mOutdir);
+    arrayList /= "arrays";
+    fs::path geneList(mOutdir);
+    geneList /= "genes";
+    fs::path dataFile(mOutdir);
+    dataFile /= "data";
+    mCheckpointFile = mOutdir / "checkpoint";
+
+    if (aAppend && fs::exists(arrayList))
+      loadExistingMatrix(arrayList, geneList, dataFile, aWriteData);
+
+    if (mAppend)
+    {
+      // The new arrays are only listed once the platform is known to match.
+      mArrayList = new std::ofstream(arrayList.string().c_str(),
+                                     std::ios::app);
+    }
+    else
+    {
+      mArrayList = new std::ofstream(arrayList.string().c_str());
+      mGeneList = new std::ofstream(geneList.string().c_str());
+    }
+  }
+
+  ~SOFT2Matrix()
+  {
+    if (mProbesets != NULL)
+      delete mProbesets;
+
+    if (mGenes != NULL)
+      delete mGenes;
+
+    if (mGeneProbesetCounts != NULL)
+      delete mGeneProbesetCounts;
+
+    if (mStats != NULL)
+      delete mStats;
+
+    delete mArrayList;
+    if (mGeneList != NULL)
+      delete mGeneList;
+
+    if (mDataFile != NULL)
+      fclose(mDataFile);
+  }
+
+  void
+  process()
+  {
+    boost::string_ref l;
+    processLine = &SOFT2Matrix::processPlatformIntro;
+
+    // Lines are counted here and published every kPublishLines, so that the
+    // loop does no atomic operations of its own.
+    uint64_t lines = 0;
+    while (mSOFTFile.nextLine(l))
+    {
+      mInputOffset += l.size() + 1;
+      (this->*processLine)(l);
+      if (++lines % kPublishLines == 0)
+      {
+        mLinesParsed.set(lines);
+        mBytesParsed.set(mInputOffset);
+      }
+    }
+    mLinesParsed.set(lines);
+    mBytesParsed.set(mInputOffset);
+
+    if (mNextSample < mSampleIds.size())
+    {
+      std::cout << "There were samples indicated in the platform sample " 
+                << "list but missing in the data file."<< std::endl;
+    }
+
+    if (mStats != NULL)
+    {
+      mStats->write(mOutdir.string(), mOutdir.string(), false);
+      mStats->save((mOutdir / MatrixStats::kSavedName).string());
+    }
+
+    // The run is complete, so there is nothing left to resume.
+    if (fs::exists(mCheckpointFile))
+      fs::remove(mCheckpointFile);
+  }
+
+  // Gathers the statistics of each row as it is written, and writes them to
+  // array_stats and gene_stats in the output directory at the end, so that
+  // they cost no extra pass over data. Their state is saved there too, and
+  // appending adds to the state saved for the rows already in the matrix.
+  // Resuming reads the rows the checkpoint covers back from data instead,
+  // as a checkpoint is taken too often to save the state each time.
+  void
+  gatherStats(const std::vector<double>& aQuantiles =
+              MatrixStats::defaultQuantiles())
+  {
+    mGatherStats = true;
+    mStatsQuantiles = aQuantiles;
+  }
+
+  // The number of samples to process between checkpoints, or 0 to never
+  // write one.
+  void
+  setCheckpointInterval(uint32_t aSamples)
+  {
+    mCheckpointInterval = aSamples;
+  }
+
+  // Loads the checkpoint left by an interrupted run on the same input, so
+  // that process() picks up where it left off: the platform is read again,
+  // then the samples already in data are passed over without being parsed.
+  // Returns false if there is no checkpoint to resume from.
+  bool
+  resumeFromCheckpoint()
+  {
+    if (!fs::exists(mCheckpointFile))
+      return false;
+    if (mAppend)
+      throw RuntimeException("Cannot resume a run that appends to a "
+                             "matrix.");
+
+    std::ifstream cp(mCheckpointFile.string().c_str());
+    std::map<std::string, uint64_t> fields;
+    std::string key;
+    uint64_t value;
+    while (cp >> key >> value)
+      fields[key] = value;
+
+    const char* needed[] = {"input_offset", "samples", "rows", "genes",
+                            "arrays"};
+    for (uint32_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+      if (fields.count(needed[i]) == 0)
+        throw RuntimeException("The checkpoint file is incomplete.");
+
+    mResumeOffset = fields["input_offset"];
+    mResumeSamples = fields["samples"];
+    mResumeRows = fields["rows"];
+    mResumeGenes = fields["genes"];
+    mResumeArrays = fields["arrays"];
+    mResuming = true;
+    return true;
+  }
+
+  static const uint32_t kDefaultCheckpointInterval = 100;
+
+  // Loads the HGNC database on aThreads threads (0 for one per
+  // processor).
+  void
+  loadHGNCDatabase(const std::string& aPath, uint32_t aThreads = 0)
+  {
+    mHGNC.load(aPath, aThreads);
+  }
+
+private:
+  // The benchmarks drive the steps of a conversion one at a time.
+  friend class SOFT2MatrixBenchmark;
+
+  fs::path mOutdir;
+  SOFTInput& mSOFTFile;
+  std::ofstream *mArrayList, *mGeneList;
+  FILE * mDataFile;
+  GeneRowSink* mSink;
+  void (SOFT2Matrix::* processLine)(boost::string_ref aLine);
+  uint32_t mnSamples;
+  // The platform's samples, as ids in mSampleNames, in the order they are
+  // expected in, and the index of the next one.
+  StringArena mSampleNames;
+  std::vector<uint32_t> mSampleIds;
+  uint32_t mNextSample;
+  double* mProbesets, * mGenes;
+  uint32_t* mGeneProbesetCounts;
+  bool mGotSampleTable, mSkippingSample, mAppend, mWriteData;
+  StringArena mExistingArrays;
+  std::vector<std::string> mExistingGenes;
+  uint32_t mExistingRows;
+
+  // Checkpointing. mInputOffset counts the bytes of (decompressed) input
+  // read so far, mSamplesSeen the ^SAMPLE records and mRowsWritten the rows
+  // of data.
+  fs::path mCheckpointFile;
+  bool mResuming;
+  uint64_t mInputOffset, mResumeOffset;
+  uint32_t mSamplesSeen, mRowsWritten, mResumeSamples, mResumeRows;
+  uint32_t mResumeGenes, mResumeArrays;
+  uint32_t mCheckpointInterval, mSamplesSinceCheckpoint;
+
+  // Counters for the progress line and the --profile report.
+  static const uint32_t kPublishLines = 4096;
+  ProfileCounter& mBytesParsed, & mLinesParsed, & mSamplesProcessed;
+  ProfileCounter& mUnknownProbeIds, & mNaNGenes;
+
+  // The statistics of the rows written, once the platform is known.
+  bool mGatherStats;
+  std::vector<double> mStatsQuantiles;
+  MatrixStats* mStats;
+
+  void
+  openDataFile()
+  {
+    fs::path dataFile(mOutdir);
+    dataFile /= "data";
+
+    // Tiles built from an earlier data file would no longer match it.
+    fs::path tiled(mOutdir);
+    tiled /= "tiled_data";
+    fs::remove(tiled);
+
+    // Any statistics saved for the earlier data have been added to mStats
+    // by now, and are saved again at the end if they are being gathered.
+    fs::remove(mOutdir / MatrixStats::kSavedName);
+
+    if (!mResuming)
+    {
+      mDataFile = fopen(dataFile.string().c_str(), mAppend ? "a" : "w");
+      if (mDataFile == NULL)
+        throw RuntimeException("Cannot open the data file.");
+      return;
+    }
+
+    if (mGeneCount != mResumeGenes || mnSamples != mResumeArrays)
+      throw RuntimeException("The checkpoint was made from a different "
+                             "platform.");
+    if (mResumeOffset < mInputOffset || mResumeSamples > mSampleIds.size())
+      throw RuntimeException("The checkpoint does not match the input.");
+
+    // Anything written after the checkpoint was taken is discarded, and
+    // written again as the input is read from the checkpoint on.
+    uint64_t committed = static_cast<uint64_t>(mResumeRows) * mGeneCount *
+      sizeof(double);
+    if (!fs::exists(dataFile) || fs::file_size(dataFile) < committed)
+      throw RuntimeException("The data file is shorter than the checkpoint "
+                             "says.");
+    if (truncate(dataFile.string().c_str(), committed) != 0)
+      throw RuntimeException("Cannot truncate the data file.");
+    if (mStats != NULL)
+      addCommittedStats(dataFile);
+    mDataFile = fopen(dataFile.string().c_str(), "a");
+    if (mDataFile == NULL)
+      throw RuntimeException("Cannot open the data file.");
+
+    mSOFTFile.skip(mResumeOffset - mInputOffset);
+    mInputOffset = mResumeOffset;
+    mNextSample = mResumeSamples;
+    mSamplesSeen = mResumeSamples;
+    mRowsWritten = mResumeRows;
+
+    std::cout << "Resuming after " << mSamplesSeen << " samples." << std::endl;
+  }
+
+  // Adds the rows the checkpoint covers to mStats, in the order they were
+  // first added, so the statistics are the same as if the run had not
+  // been interrupted.
+  void
+  addCommittedStats(const fs::path& aDataFile)
+  {
+    FILE* f = fopen(aDataFile.string().c_str(), "r");
+    if (f == NULL)
+      throw RuntimeException("Cannot open the data file.");
+    const uint32_t kBlockRows = 256;
+    std::vector<double> block(static_cast<uint64_t>(kBlockRows) * mGeneCount);
+    for (uint32_t r = 0; r < mResumeRows; r += kBlockRows)
+    {
+      uint32_t n = std::min(kBlockRows, mResumeRows - r);
+      if (mGeneCount != 0 &&
+          fread(&block[0], sizeof(double) * mGeneCount, n, f) != n)
+      {
+        fclose(f);
+        throw RuntimeException("Cannot read the data file back.");
+      }
+      mStats->addRows(block.empty() ? NULL : &block[0], n);
+    }
+    fclose(f);
+  }
+
+  // The data is flushed to disk before the checkpoint that covers it, and
+  // the checkpoint replaces the previous one with a rename, so whatever
+  // point a run is stopped at, the checkpoint on disk describes data that
+  // is really there.
+  void
+  writeCheckpoint()
+  {
+    mSamplesSinceCheckpoint = 0;
+
+    fflush(mDataFile);
+    if (fdatasync(fileno(mDataFile)) != 0)
+    {
+      std::cout << "Failed to sync data; not checkpointing." << std::endl;
+      return;
+    }
+
+    fs::path tmp(mCheckpointFile.string() + ".tmp");
+    FILE* f = fopen(tmp.string().c_str(), "w");
+    if (f == NULL)
+    {
+      std::cout << "Failed to write a checkpoint." << std::endl;
+      return;
+    }
+    fprintf(f, "input_offset %llu\nsamples %u\nrows %u\ngenes %u\n"
+            "arrays %u\n", static_cast<unsigned long long>(mInputOffset),
+            mSamplesSeen, mRowsWritten, mGeneCount, mnSamples);
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.string().c_str(),
+                      mCheckpointFile.string().c_str()) != 0)
+      std::cout << "Failed to write a checkpoint." << std::endl;
+  }
+
+  void
+  loadExistingMatrix(const fs::path& aArrayList, const fs::path& aGeneList,
+                     const fs::path& aDataFile, bool aCheckData)
+  {
+    mAppend = true;
+
+    std::vector<std::string> arrays;
+    readLabels(aArrayList.string(), arrays);
+    for (std::vector<std::string>::iterator i = arrays.begin();
+         i != arrays.end(); i++)
+      mExistingArrays.intern(*i);
+    readLabels(aGeneList.string(), mExistingGenes);
+    mExistingRows = arrays.size();
+
+    if (!aCheckData)
+      return;
+
+    uint64_t size = fs::exists(aDataFile) ? fs::file_size(aDataFile) : 0;
+    if (size != static_cast<uint64_t>(arrays.size()) * mExistingGenes.size() *
+        sizeof(double))
+      throw RuntimeException("The existing data does not match its arrays "
+                             "and genes files.");
+  }
+
+  void
+  processPlatformIntro(boost::string_ref aLine)
+  {
+    if (aLine == "!platform_table_begin")
+    {
+      mNextSample = 0;
+      processLine = &SOFT2Matrix::processPlatformHeader;
+      return;
+    }
+
+    if (aLine.starts_with("!Platform_sample_id = "))
+    {
+      boost::string_ref sampleId(aLine.substr(22));
+      mSampleIds.push_back(mSampleNames.intern(sampleId));
+      if (mExistingArrays.find(sampleId) != StringArena::kNotFound)
+        return;
+      if (!mAppend)
+        (*mArrayList) << sampleId << std::endl;
+      mnSamples++;
+    }
+  }
+
+  void
+  processPlatformHeader(boost::string_ref aLine)
+  {
+    processLine = &SOFT2Matrix::processPlatformTable;
+
+    TabFields fields(aLine);
+    boost::string_ref f;
+    for (uint32_t n = 0; fields.next(f); n++)
+    {
+      if (f == "ID")
+        mIdIndex = n;
+      else if (f == "Gene Symbol")
+        mGeneSymbolIndex = n;
+    }
+  }
+
+  uint32_t mIdIndex, mGeneSymbolIndex, mValueIndex;
+  uint32_t mProbesetCount, mGeneCount;
+
+  void
+  fillProbesetArrayWithNans()
+  {
+    for (uint32_t i = 0; i < mProbesetCount; i++)
+      mProbesets[i] = std::numeric_limits<double>::quiet_NaN();
+  }
+
+  uint32_t
+  findHGNCIdByName(const std::string& aName, bool stripDashes = true)
+  {
+    // Look up the name from HGNC...
+    uint32_t id = mHGNC.lookup(aName);
+    if (id != 0)
+      return id;
+
+    // See if it ends in a number...
+    static const boost::regex endNumber("(\\-?)([0-9]+)$");
+    boost::smatch res;
+    if (boost::regex_search(aName, res, endNumber))
+    {
+      id = mHGNC.lookup(boost::string_ref(aName.data(),
+                                               res.prefix().length()));
+      if (id != 0)
+        return id;
+
+      std::string tryAlso;
+      if (res[2].str() == "alpha")
+        tryAlso = "A";
+      else if (res[2].str() == "beta")
+        tryAlso = "B";
+      else if (res[2].str() == "1")
+        tryAlso = "I";
+      else if (res[2].str() == "2")
+        tryAlso = "II";
+
+      std::string attempt(res.prefix().str());
+      attempt += tryAlso;
+      id = mHGNC.lookup(attempt);
+      if (id != 0)
+        return id;
+    }
+
+    // Try adding a suffix like 1 or A...
+    std::string attempt = aName + "1";
+    id = mHGNC.lookup(attempt);
+    if (id != 0)
+      return id;
+    
+    attempt = aName + "A";
+    id = mHGNC.lookup(attempt);
+    if (id != 0)
+      return id;
+
+    if (stripDashes)
+    {
+      // Strip out all dashes and repeat...
+      std::string dashless(boost::replace_all_copy(aName, "ALPHA", "A"));
+      boost::replace_all(dashless, "-", "");
+      return findHGNCIdByName(dashless, false);
+    }
+
+    return 0;
+  }
+
+  void
+  platformTableDone()
+  {
+    mProbesets = new double[mProbesetCount];
+    fillProbesetArrayWithNans();
+    
+    std::sort(mUsedHGNCIds.begin(), mUsedHGNCIds.end());
+    mUsedHGNCIds.erase(std::unique(mUsedHGNCIds.begin(), mUsedHGNCIds.end()),
+                       mUsedHGNCIds.end());
+    mGeneCount = mUsedHGNCIds.size();
+    mGenes = new double[mGeneCount];
+    mGeneProbesetCounts = new uint32_t[mGeneCount];
+
+    std::cout << "mGeneCount = " << mGeneCount << std::endl
+              << "mnSamples = " << mnSamples << std::endl;
+
+    if (mSink != NULL)
+      mSink->beginMatrix(mnSamples, mGeneCount);
+    if (mGatherStats)
+    {
+      mStats = new MatrixStats(mGeneCount, mStatsQuantiles, 0,
+                               mExistingRows + mnSamples);
+      if (mAppend)
+      {
+        mStats->addSaved((mOutdir / MatrixStats::kSavedName).string());
+        if (mStats->rows() != mExistingRows)
+          throw RuntimeException("The saved statistics are not for the rows "
+                                 "already in the matrix.");
+      }
+      mStats->printSketchSize(mExistingRows + mnSamples);
+    }
+    if (mWriteData)
+      openDataFile();
+
+    std::map<uint32_t, uint32_t> hgncIdToGeneIndex;
+    uint32_t geneIndex(0);
+
+    typedef std::pair<uint32_t, uint32_t> pairu32;
+
+    for (std::vector<uint32_t>::iterator i = mUsedHGNCIds.begin();
+         i != mUsedHGNCIds.end();
+         i++, geneIndex++)
+    {
+      hgncIdToGeneIndex.insert(pairu32(*i, geneIndex));
+      boost::string_ref name(mHGNC.approvedName(*i));
+      if (mAppend)
+      {
+        if (geneIndex >= mExistingGenes.size() ||
+            mExistingGenes[geneIndex] != name)
+          throw RuntimeException("The platform does not map to the genes "
+                                 "already in the matrix.");
+      }
+      else
+        (*mGeneList) << name << std::endl;
+    }
+    if (mAppend)
+    {
+      if (mGeneCount != mExistingGenes.size())
+        throw RuntimeException("The platform does not map to the genes "
+                               "already in the matrix.");
+      for (std::vector<uint32_t>::iterator i = mSampleIds.begin();
+           i != mSampleIds.end(); i++)
+        if (mExistingArrays.find(mSampleNames.str(*i)) ==
+            StringArena::kNotFound)
+          (*mArrayList) << mSampleNames.str(*i) << std::endl;
+    }
+
+    std::transform(
+                   mProbesetHGNCIdList.begin(),
+                   mProbesetHGNCIdList.end(),
+                   std::back_inserter(mProbesetGeneList),
+                   bll::bind<pairu32>
+                   (
+                    bll::constructor<pairu32>(),
+                    bll::bind(&pairu32::first, bll::_1),
+                    bll::var(hgncIdToGeneIndex)
+                    [bll::bind<uint32_t>(&pairu32::second, bll::_1)]
+                   )
+                  );
+
+    // The HGNC database is only needed to map the platform, so all of it
+    // can go now, arenas and all.
+    mHGNC.clear();
+    std::vector<pairu32>().swap(mProbesetHGNCIdList);
+
+    processLine = &SOFT2Matrix::processSampleIntro;
+  }
+
+  void
+  processPlatformTable(boost::string_ref aLine)
+  {
+    if (aLine == "!platform_table_end")
+    {
+      platformTableDone();
+      return;
+    }
+
+    TabFields fields(aLine);
+    boost::string_ref f, id, symbolField;
+    for (uint32_t n = 0; fields.next(f); n++)
+    {
+      if (n == mIdIndex)
+        id = f;
+      else if (n == mGeneSymbolIndex)
+        symbolField = f;
+    }
+
+    if (symbolField.empty())
+      return;
+    std::string symbol(symbolField.begin(), symbolField.end());
+
+    // Symbol is a list of genes, some of which will be in HGNC...
+    static const boost::regex geneSep(" // ");
+    boost::sregex_token_iterator rti
+      (boost::make_regex_token_iterator(symbol, geneSep, -1));
+
+    // A probeset only lists a handful of genes, so the ones already seen
+    // are found by looking back through its entries.
+    uint32_t firstEntry = mProbesetHGNCIdList.size();
+    for (; rti != boost::sregex_token_iterator(); rti++)
+    {
+      uint32_t hgncid(findHGNCIdByName(*rti));
+      if (hgncid == 0)
+        continue;
+
+      bool seen = false;
+      for (uint32_t e = firstEntry; e < mProbesetHGNCIdList.size() && !seen;
+           e++)
+        seen = mProbesetHGNCIdList[e].first == hgncid;
+      if (seen)
+        continue;
+      mUsedHGNCIds.push_back(hgncid);
+
+      mProbesetHGNCIdList.push_back(std::pair<uint32_t, uint32_t>
+                                    (hgncid, mProbesetCount));
+    }
+
+    // Only the first probeset with a given ID can be looked up.
+    if (mProbesetIds.intern(id) == mProbesetIndexById.size())
+      mProbesetIndexById.push_back(mProbesetCount);
+    mProbesetCount++;
+  }
+
+  // Probeset IDs, and the index of the probeset for each one.
+  StringArena mProbesetIds;
+  std::vector<uint32_t> mProbesetIndexById;
+  std::vector<std::pair<uint32_t, uint32_t> > mProbesetHGNCIdList,
+    mProbesetGeneList;
+  // The HGNC ids of genes on the platform; sorted, and made unique, once
+  // the platform table is done.
+  std::vector<uint32_t> mUsedHGNCIds;
+
+  void
+  processSampleIntro(boost::string_ref aLine)
+  {
+    if (aLine.starts_with("^SAMPLE = "))
+    {
+      if (!mGotSampleTable && !mSkippingSample)
+      {
+        // This means we found two ^SAMPLE records with no intervening 
+        // !sample_table_begin lines! Write a message...
+        std::cout << "Warning: Next sample found without a "
+          "!sample_table_begin line!" << std::endl;
+
+        // Next, we need to write out a NaN-filled placeholder entry for the
+        // missing data...
+        for (uint32_t i = 0; i < mGeneCount; i++)
+          mGenes[i] = std::numeric_limits<double>::quiet_NaN();
+        mNaNGenes.add(mGeneCount);
+        writeGeneRow();
+      }
+
+      mGotSampleTable = false;
+      boost::string_ref sampId = aLine.substr(10);
+      mSkippingSample = mExistingArrays.find(sampId) != StringArena::kNotFound;
+      boost::string_ref expected;
+      if (mNextSample < mSampleIds.size())
+        expected = mSampleNames.str(mSampleIds[mNextSample]);
+      if (sampId != expected)
+        std::cout << "Sample ID mismatch: expected "
+                  << expected << " got " << sampId
+                  << std::endl;
+      else if (mSkippingSample)
+        std::cout << "Skip: " << sampId << std::endl;
+      else
+        std::cout << "Proc: " << sampId << std::endl;
+      mNextSample++;
+      mSamplesSeen++;
+      return;
+    }
+    if (aLine == "!sample_table_begin")
+    {
+      mGotSampleTable = true;
+      if (mSkippingSample)
+        processLine = &SOFT2Matrix::processSkippedSampleTable;
+      else
+        processLine = &SOFT2Matrix::processSampleHeader;
+    }
+  }
+
+  // Samples already in the matrix being appended to are passed over a line
+  // at a time, without being tokenised.
+  void
+  processSkippedSampleTable(boost::string_ref aLine)
+  {
+    if (aLine == "!sample_table_end")
+      processLine = &SOFT2Matrix::processSampleIntro;
+  }
+
+  void
+  processSampleHeader(boost::string_ref aLine)
+  {
+    processLine = &SOFT2Matrix::processSampleTable;
+
+    TabFields fields(aLine);
+    boost::string_ref f;
+    for (uint32_t n = 0; fields.next(f); n++)
+    {
+      if (f == "ID_REF")
+        mIdIndex = n;
+      else if (f == "VALUE")
+        mValueIndex = n;
+    }
+  }
+
+  void
+  writeGeneRow()
+  {
+    if (mDataFile != NULL)
+    {
+      if (fwrite(mGenes, mGeneCount * sizeof(double), 1, mDataFile) != 1)
+      {
+        std::cout << "Failed to write record." << std::endl;
+      }
+
+      fflush(mDataFile); // Makes checking file sizes easier...
+      mRowsWritten++;
+    }
+
+    if (mSink != NULL)
+      mSink->geneRow(mGenes);
+    if (mStats != NULL)
+      mStats->addRow(mGenes);
+  }
+
+  void
+  sampleTableDone()
+  {
+    memset(mGenes, 0, sizeof(double) * mGeneCount);
+    memset(mGeneProbesetCounts, 0, sizeof(uint32_t) * mGeneCount);
+
+    for (std::vector<std::pair<uint32_t, uint32_t> >::iterator i(mProbesetGeneList.begin());
+         i != mProbesetGeneList.end();
+         i++)
+    {
+      uint32_t probeset = (*i).first;
+      uint32_t gene = (*i).second;
+
+      if (isfinite(mProbesets[probeset]))
+      {
+        mGeneProbesetCounts[gene]++;
+        mGenes[gene] += mProbesets[probeset];
+      }
+    }
+    
+    uint32_t nanGenes = 0;
+    for (uint32_t i = 0; i < mGeneCount; i++)
+    {
+      if (mGeneProbesetCounts[i] == 0)
+      {
+        mGenes[i] = std::numeric_limits<double>::quiet_NaN();
+        nanGenes++;
+      }
+      else
+        mGenes[i] /= mGeneProbesetCounts[i];
+    }
+    mNaNGenes.add(nanGenes);
+    mSamplesProcessed.add();
+
+    writeGeneRow();
+
+    fillProbesetArrayWithNans();
+    processLine = &SOFT2Matrix::processSampleIntro;
+
+    if (mDataFile != NULL && !mAppend && mCheckpointInterval != 0 &&
+        ++mSamplesSinceCheckpoint >= mCheckpointInterval)
+      writeCheckpoint();
+  }
+
+  void
+  processSampleTable(boost::string_ref aLine)
+  {
+    if (aLine == "!sample_table_end")
+    {
+      sampleTableDone();
+      return;
+    }
+
+    TabFields fields(aLine);
+    boost::string_ref f, id, value;
+    for (uint32_t n = 0; fields.next(f); n++)
+    {
+      if (n == mIdIndex)
+        id = f;
+      else if (n == mValueIndex)
+        value = f;
+    }
+
+    uint32_t probeset = mProbesetIds.find(id);
+    if (probeset == StringArena::kNotFound)
+    {
+      // std::cout << "Unknown probe ID " << id << std::endl;
+      mUnknownProbeIds.add();
+      return;
+    }
+
+    mProbesets[mProbesetIndexById[probeset]] = parseValue(value);
+  }
+
+  // strtod() needs a terminated string, and a field of a mapped file is not
+  // one, so the value is copied out first.
+  static double
+  parseValue(boost::string_ref aValue)
+  {
+    char buf[64];
+    if (aValue.size() >= sizeof(buf))
+      return strtod(std::string(aValue.begin(), aValue.end()).c_str(), NULL);
+    memcpy(buf, aValue.data(), aValue.size());
+    buf[aValue.size()] = 0;
+    return strtod(buf, NULL);
+  }
+
+  HGNCDatabase mHGNC;
+};
+
+#endif // SOFT2MATRIX_HPP
@@ -0,0 +1,258 @@
+/*
+    SOFTInput: Read the lines of a SOFT file, compressed or not.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "SOFTInput.hpp"
+#include "RuntimeException.hpp"
+#include <boost/bind.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace io = boost::iostreams;
+
+SOFTInput::Format
+SOFTInput::detectFormat(const std::string& aPath)
+{
+  unsigned char magic[3];
+  int fd = open(aPath.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw RuntimeException("Cannot open the SOFT file.");
+  ssize_t n = read(fd, magic, sizeof(magic));
+  close(fd);
+
+  if (n == 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
+    return kBzip2;
+  if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+    return kGzip;
+  return kPlain;
+}
+
+SOFTInput::SOFTInput(const std::string& aPath)
+  : mFormat(detectFormat(aPath)), mMapping(NULL), mMappingSize(0),
+    mDecompressor(NULL), mStopping(false), mFailed(false),
+    mBytesDecompressed(Profile::counter("bytes_decompressed")),
+    mDecompressTimer(Profile::timer("decompress")), mCur(NULL),
+    mEnd(NULL), mBlockIndex(0), mHaveBlock(false), mAtEnd(false)
+{
+  if (mFormat == kPlain)
+  {
+    int fd = open(aPath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      if (fd >= 0)
+        close(fd);
+      throw RuntimeException("Cannot open the SOFT file.");
+    }
+
+    mMappingSize = st.st_size;
+    if (mMappingSize != 0)
+    {
+      void* p = mmap(NULL, mMappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+      {
+        close(fd);
+        throw RuntimeException("Cannot map the SOFT file.");
+      }
+      mMapping = static_cast<char*>(p);
+      madvise(mMapping, mMappingSize, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    mCur = mMapping;
+    mEnd = mMapping + mMappingSize;
+    return;
+  }
+
+  if (mFormat == kBzip2)
+    mStream.push(io::bzip2_decompressor());
+  else
+    mStream.push(io::gzip_decompressor());
+  mStream.push(io::file_source(aPath, std::ios::binary));
+  mStream.exceptions(std::ios::badbit);
+
+  mBlocks.resize(kBlocks);
+  for (uint32_t i = 0; i < kBlocks; i++)
+  {
+    mBlocks[i].mData = new char[kBlockBytes];
+    mBlocks[i].mSize = 0;
+    mBlocks[i].mFull = false;
+  }
+  mDecompressor = new boost::thread(boost::bind(&SOFTInput::decompress,
+                                                this));
+}
+
+SOFTInput::~SOFTInput()
+{
+  if (mDecompressor != NULL)
+  {
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      mStopping = true;
+    }
+    mBlockEmptied.notify_all();
+    mDecompressor->join();
+    delete mDecompressor;
+  }
+  for (uint32_t i = 0; i < mBlocks.size(); i++)
+    delete [] mBlocks[i].mData;
+
+  if (mMapping != NULL)
+    munmap(mMapping, mMappingSize);
+}
+
+void
+SOFTInput::decompress()
+{
+  for (uint64_t b = 0;; b++)
+  {
+    Block& s = mBlocks[b % kBlocks];
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      while (s.mFull && !mStopping)
+        mBlockEmptied.wait(lock);
+      if (mStopping)
+        return;
+    }
+
+    // The block is ours until we mark it as full, so read without the lock.
+    uint32_t got = 0;
+    bool failed = false;
+    try
+    {
+      ScopedProfileTimer timer(mDecompressTimer);
+      mStream.read(s.mData, kBlockBytes);
+      got = mStream.gcount();
+    }
+    catch (std::exception&)
+    {
+      failed = true;
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if (failed)
+    {
+      mFailed = true;
+      mBlockFilled.notify_all();
+      return;
+    }
+    s.mSize = got;
+    s.mFull = true;
+    mBytesDecompressed.add(got);
+    mBlockFilled.notify_all();
+    if (got == 0)
+      return;
+  }
+}
+
+bool
+SOFTInput::nextBlock()
+{
+  if (mFormat == kPlain || mAtEnd)
+    return false;
+
+  if (mHaveBlock)
+  {
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      mBlocks[mBlockIndex % kBlocks].mFull = false;
+    }
+    mBlockEmptied.notify_all();
+    mBlockIndex++;
+    mHaveBlock = false;
+  }
+
+  Block& s = mBlocks[mBlockIndex % kBlocks];
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    while (!s.mFull && !mFailed)
+      mBlockFilled.wait(lock);
+    if (!s.mFull)
+      throw RuntimeException("The SOFT file could not be decompressed.");
+  }
+
+  if (s.mSize == 0)
+  {
+    mAtEnd = true;
+    return false;
+  }
+  mHaveBlock = true;
+  mCur = s.mData;
+  mEnd = s.mData + s.mSize;
+  return true;
+}
+
+bool
+SOFTInput::nextLine(boost::string_ref& aLine)
+{
+  bool carrying = false;
+  mCarry.clear();
+
+  while (true)
+  {
+    if (mCur == mEnd)
+    {
+      if (nextBlock())
+        continue;
+      if (!carrying)
+        return false;
+      aLine = mCarry;
+      return true;
+    }
+
+    const char* nl = static_cast<const char*>(memchr(mCur, '\n',
+                                                     mEnd - mCur));
+    if (nl == NULL)
+    {
+      // The line runs on into the next block.
+      mCarry.append(mCur, mEnd);
+      carrying = true;
+      mCur = mEnd;
+      continue;
+    }
+
+    if (carrying)
+    {
+      mCarry.append(mCur, nl);
+      aLine = mCarry;
+    }
+    else
+      aLine = boost::string_ref(mCur, nl - mCur);
+    mCur = nl + 1;
+    return true;
+  }
+}
+
+void
+SOFTInput::skip(uint64_t aBytes)
+{
+  while (aBytes > 0)
+  {
+    if (mCur == mEnd && !nextBlock())
+      return;
+    uint64_t n = mEnd - mCur;
+    if (n > aBytes)
+      n = aBytes;
+    mCur += n;
+    aBytes -= n;
+  }
+}
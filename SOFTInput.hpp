@@ -0,0 +1,139 @@
+/*
+    SOFTInput: Read the lines of a SOFT file, compressed or not.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SOFT_INPUT_HPP
+#define SOFT_INPUT_HPP
+
+#include "Profile.hpp"
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Hands out the lines of a SOFT file. The format is worked out from the
+// first bytes of the file: bzip2 and gzip (including gzip files of several
+// members) are decompressed on a background thread, a block at a time,
+// while the lines of the last block are being parsed; anything else is
+// taken to be plain text, which is mapped into memory and handed out in
+// place, without being copied at all.
+class SOFTInput
+{
+public:
+  enum Format
+  {
+    kPlain,
+    kGzip,
+    kBzip2
+  };
+
+  SOFTInput(const std::string& aPath);
+  ~SOFTInput();
+
+  static Format detectFormat(const std::string& aPath);
+
+  Format
+  format() const
+  {
+    return mFormat;
+  }
+
+  // Sets aLine to the next line, without its newline, returning false at
+  // the end of the file. The line is only valid until the next call.
+  bool nextLine(boost::string_ref& aLine);
+
+  // Passes over the next aBytes bytes without looking for lines in them.
+  void skip(uint64_t aBytes);
+
+  static const uint32_t kBlockBytes = 1 << 20;
+  static const uint32_t kBlocks = 4;
+
+private:
+  struct Block
+  {
+    char* mData;
+    uint32_t mSize;
+    bool mFull;
+  };
+
+  Format mFormat;
+
+  // Plain text: the mapping of the whole file.
+  char* mMapping;
+  uint64_t mMappingSize;
+
+  // Compressed input: the decompressing stream, and the ring of blocks the
+  // background thread fills from it. A block of size 0 marks the end.
+  boost::iostreams::filtering_istream mStream;
+  std::vector<Block> mBlocks;
+  boost::mutex mMutex;
+  boost::condition_variable mBlockFilled, mBlockEmptied;
+  boost::thread* mDecompressor;
+  bool mStopping, mFailed;
+  ProfileCounter& mBytesDecompressed;
+  ProfileTimer& mDecompressTimer;
+
+  // The unread part of the current block (or of the mapping), and the part
+  // of a line carried over from earlier blocks.
+  const char* mCur, * mEnd;
+  uint64_t mBlockIndex;
+  bool mHaveBlock, mAtEnd;
+  std::string mCarry;
+
+  SOFTInput(const SOFTInput&);
+  SOFTInput& operator=(const SOFTInput&);
+
+  void decompress();
+  bool nextBlock();
+};
+
+// Splits a tab-separated line into its fields, in place.
+class TabFields
+{
+public:
+  TabFields(boost::string_ref aLine)
+    : mRest(aLine), mDone(false)
+  {
+  }
+
+  bool
+  next(boost::string_ref& aField)
+  {
+    if (mDone)
+      return false;
+
+    size_t tab = mRest.find('\t');
+    if (tab == boost::string_ref::npos)
+    {
+      aField = mRest;
+      mDone = true;
+      return true;
+    }
+    aField = mRest.substr(0, tab);
+    mRest = mRest.substr(tab + 1);
+    return true;
+  }
+
+private:
+  boost::string_ref mRest;
+  bool mDone;
+};
+
+#endif // SOFT_INPUT_HPP
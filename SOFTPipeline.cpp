@@ -0,0 +1,304 @@
+/*
+    SOFTPipeline: Convert a SOFT file and rank transform it in one pass.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include "SOFT2Matrix.hpp"
+#include "RowReader.hpp"
+#include "RowRanker.hpp"
+#include "TransposeWriter.hpp"
+#include "RuntimeException.hpp"
+
+namespace po = boost::program_options;
+
+// Takes the gene rows straight from SOFT2Matrix, and produces whichever of
+// the transposed data, the ranks and the transposed ranks were asked for,
+// without the intermediate files that running SOFT2Matrix, InvertData and
+// RankTransformDataset one after another would need.
+//
+// Plain rank transforms are done as each row arrives. Quantile normalisation
+// needs every row to be seen before any can be normalised, so the raw rows
+// are read back for a second pass: from the data file if one is being
+// written anyway, or otherwise from a temporary spill file.
+class PipelineSink
+  : public GeneRowSink
+{
+public:
+  PipelineSink(const std::string& aOutdir, bool aWriteData,
+               bool aInverseData, const std::string& aRanks,
+               const std::string& aTransposedRanks,
+               bool aQuantileNormalisation)
+    : mOutdir(aOutdir), mWriteData(aWriteData), mInverseData(aInverseData),
+      mRanksPath(aRanks), mTransposedRanksPath(aTransposedRanks),
+      mQuantileNormalisation(aQuantileNormalisation), mnSamples(0),
+      mnGenes(0), mInverseWriter(NULL), mRanks(NULL),
+      mTransposedRanks(NULL), mRanker(NULL), mWorkspace(NULL), mSpill(NULL)
+  {
+  }
+
+  ~PipelineSink()
+  {
+    if (mInverseWriter != NULL)
+      delete mInverseWriter;
+    if (mRanks != NULL)
+      fclose(mRanks);
+    if (mTransposedRanks != NULL)
+      delete mTransposedRanks;
+    if (mRanker != NULL)
+      delete mRanker;
+    if (mWorkspace != NULL)
+      delete mWorkspace;
+    if (mSpill != NULL)
+      fclose(mSpill);
+  }
+
+  void
+  beginMatrix(uint32_t aSamples, uint32_t aGenes)
+  {
+    mnSamples = aSamples;
+    mnGenes = aGenes;
+
+    if (mInverseData)
+    {
+      fs::path invdata(mOutdir);
+      invdata /= "inverse_data";
+      mInverseWriter = new TransposeWriter(invdata.string(), mnSamples,
+                                           mnGenes);
+    }
+
+    if (!ranking())
+      return;
+
+    mRanker = new RowRanker(mnGenes, mQuantileNormalisation);
+    mWorkspace = new RankWorkspace(mnGenes);
+
+    if (mRanksPath != "")
+    {
+      mRanks = fopen(mRanksPath.c_str(), "w");
+      if (mRanks == NULL)
+        throw RuntimeException("Cannot open the ranks output file.");
+    }
+    if (mTransposedRanksPath != "")
+      mTransposedRanks = new TransposeWriter(mTransposedRanksPath, mnSamples,
+                                             mnGenes);
+
+    if (mQuantileNormalisation && !mWriteData)
+    {
+      mSpill = fopen(spillPath().c_str(), "w");
+      if (mSpill == NULL)
+        throw RuntimeException("Cannot open the temporary spill file.");
+    }
+  }
+
+  void
+  geneRow(const double* aGenes)
+  {
+    if (mInverseWriter != NULL)
+      mInverseWriter->addRow(aGenes);
+
+    if (!ranking())
+      return;
+
+    if (mQuantileNormalisation)
+    {
+      mRanker->accumulateRankAverages(aGenes, *mWorkspace);
+      if (mSpill != NULL &&
+          fwrite(aGenes, sizeof(double), mnGenes, mSpill) != mnGenes)
+        throw RuntimeException("Failed to write to the spill file.");
+    }
+    else
+      writeRanks(aGenes);
+  }
+
+  // Called once the whole SOFT file has been processed.
+  void
+  finish()
+  {
+    if (mInverseWriter != NULL)
+      mInverseWriter->finish();
+
+    if (mRanker != NULL && mQuantileNormalisation)
+    {
+      mRanker->finishRankAverages();
+
+      std::string raw;
+      if (mSpill != NULL)
+      {
+        fclose(mSpill);
+        mSpill = NULL;
+        raw = spillPath();
+      }
+      else
+      {
+        fs::path data(mOutdir);
+        data /= "data";
+        raw = data.string();
+      }
+
+      {
+        RowReader rr(raw, mnGenes);
+        const double* row;
+        while ((row = rr.nextRow()) != NULL)
+          writeRanks(row);
+      }
+
+      if (!mWriteData)
+        fs::remove(raw);
+    }
+
+    if (mTransposedRanks != NULL)
+      mTransposedRanks->finish();
+  }
+
+private:
+  fs::path mOutdir;
+  bool mWriteData, mInverseData;
+  std::string mRanksPath, mTransposedRanksPath;
+  bool mQuantileNormalisation;
+  uint32_t mnSamples, mnGenes;
+  TransposeWriter* mInverseWriter;
+  FILE* mRanks;
+  TransposeWriter* mTransposedRanks;
+  RowRanker* mRanker;
+  RankWorkspace* mWorkspace;
+  FILE* mSpill;
+
+  bool
+  ranking()
+  {
+    return mRanksPath != "" || mTransposedRanksPath != "";
+  }
+
+  std::string
+  spillPath()
+  {
+    fs::path spill(mOutdir);
+    spill /= "data.spill";
+    return spill.string();
+  }
+
+  void
+  writeRanks(const double* aRow)
+  {
+    mRanker->rankRow(aRow, *mWorkspace);
+    if (mRanks != NULL &&
+        fwrite(mWorkspace->mRanks, sizeof(double), mnGenes, mRanks) != mnGenes)
+      throw RuntimeException("Failed to write to the ranks file.");
+    if (mTransposedRanks != NULL)
+      mTransposedRanks->addRow(mWorkspace->mRanks);
+  }
+};
+
+int
+main(int argc, char** argv)
+{
+  std::string soft, outdir, hgnc, ranks, transposedRanks, profile;
+  uint32_t progress = 0;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("SOFT", po::value<std::string>(&soft), "The SOFT file to process, "
+     "compressed with bzip2 or gzip or not at all")
+    ("outdir", po::value<std::string>(&outdir), "The directory to put the "
+     "array and gene lists, and any data files asked for, into")
+    ("hgnc", po::value<std::string>(&hgnc), "File containing the HGNC names database")
+    ("data", "Write the gene matrix to data in the output directory")
+    ("inverse_data", "Write the transposed gene matrix to inverse_data in the "
+     "output directory")
+    ("ranks", po::value<std::string>(&ranks),
+     "The file to write the rank transformed matrix into")
+    ("transposed_ranks", po::value<std::string>(&transposedRanks),
+     "The file to write the transpose of the rank transformed matrix into")
+    ("qnorm", "Quantile normalise instead of rank transforming")
+    ("help", "produce help message")
+    ;
+  desc.add(MatrixStats::options("outdir"));
+  desc.add(Profile::options(profile, progress));
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("SOFT"))
+      wrong = "SOFT";
+    else if (!vm.count("outdir"))
+      wrong = "outdir";
+    else if (!vm.count("hgnc"))
+      wrong = "hgnc";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(soft))
+  {
+    std::cerr << "Invalid SOFT filename supplied." << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(outdir))
+  {
+    std::cerr << "Output 'directory' is not a directory." << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(hgnc))
+  {
+    std::cerr << "Invalid HGNC filename supplied." << std::endl;
+    return 1;
+  }
+
+  if (profile != "")
+    Profile::enable();
+  ScopedProgress progressLine("SOFTPipeline", progress);
+
+  try
+  {
+    SOFTInput input(soft);
+    bool writeData = vm.count("data") != 0;
+    PipelineSink sink(outdir, writeData, vm.count("inverse_data") != 0,
+                      ranks, transposedRanks, vm.count("qnorm") != 0);
+    {
+      SOFT2Matrix s2m(input, outdir, &sink, writeData);
+      // The sink's state cannot be recovered, so there is no resuming.
+      s2m.setCheckpointInterval(0);
+      if (vm.count("stats"))
+        s2m.gatherStats();
+      s2m.loadHGNCDatabase(hgnc);
+      s2m.process();
+    }
+    sink.finish();
+    if (profile != "")
+      Profile::writeReport(profile, "SOFTPipeline");
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
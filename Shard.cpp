@@ -0,0 +1,120 @@
+/*
+    Shard: Split the rows of a matrix between several processes.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Shard.hpp"
+#include "RuntimeException.hpp"
+#include <boost/lexical_cast.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+Shard::Shard(const std::string& aSpec)
+  : mIndex(0), mCount(1)
+{
+  const char* s = aSpec.c_str();
+  char* end;
+  unsigned long i = strtoul(s, &end, 10);
+  if (end == s || *end != '/')
+    throw RuntimeException("A shard must be given as i/N.");
+  s = end + 1;
+  unsigned long n = strtoul(s, &end, 10);
+  if (end == s || *end != 0 || n == 0 || i >= n)
+    throw RuntimeException("A shard must be given as i/N, with i < N.");
+
+  mIndex = i;
+  mCount = n;
+}
+
+void
+Shard::rowRange(uint64_t aRows, uint64_t aBlockRows, uint64_t& aFirst,
+                uint64_t& aEnd) const
+{
+  uint64_t blocks = (aRows + aBlockRows - 1) / aBlockRows;
+  aFirst = (blocks * mIndex / mCount) * aBlockRows;
+  aEnd = (blocks * (mIndex + 1) / mCount) * aBlockRows;
+  if (aFirst > aRows)
+    aFirst = aRows;
+  if (aEnd > aRows)
+    aEnd = aRows;
+}
+
+bool
+runLocalShards(int argc, char** argv, uint32_t aCount,
+               const std::vector<std::string>& aExtraArgs)
+{
+  std::vector<std::string> args;
+  args.push_back(argv[0]);
+  for (int i = 1; i < argc; i++)
+  {
+    std::string a(argv[i]);
+    if (a == "--local_shards")
+    {
+      i++;
+      continue;
+    }
+    if (a.compare(0, 15, "--local_shards=") == 0)
+      continue;
+    args.push_back(a);
+  }
+  args.push_back("--shard");
+  args.push_back("");
+  args.insert(args.end(), aExtraArgs.begin(), aExtraArgs.end());
+  uint32_t shardArg = args.size() - aExtraArgs.size() - 1;
+
+  std::vector<pid_t> children;
+  for (uint32_t s = 0; s < aCount; s++)
+  {
+    args[shardArg] = boost::lexical_cast<std::string>(s) + "/" +
+      boost::lexical_cast<std::string>(aCount);
+
+    std::vector<char*> cargs;
+    for (std::vector<std::string>::iterator i = args.begin();
+         i != args.end(); i++)
+      cargs.push_back(const_cast<char*>(i->c_str()));
+    cargs.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // /proc/self/exe is this program, wherever it was run from.
+      execv("/proc/self/exe", &cargs[0]);
+      execvp(cargs[0], &cargs[0]);
+      std::cerr << "Cannot run shard " << s << ": " << strerror(errno)
+                << std::endl;
+      _exit(127);
+    }
+    if (pid < 0)
+      std::cerr << "Cannot start shard " << s << std::endl;
+    else
+      children.push_back(pid);
+  }
+
+  bool ok = children.size() == aCount;
+  for (std::vector<pid_t>::iterator i = children.begin();
+       i != children.end(); i++)
+  {
+    int status;
+    if (waitpid(*i, &status, 0) != *i || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+      ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,74 @@
+/*
+    Shard: Split the rows of a matrix between several processes.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// One of N row-range shards of a matrix, as given by --shard i/N. Rows are
+// handed out in whole blocks, so that shards line up with any block
+// structure the work has (see RowRanker).
+class Shard
+{
+public:
+  // The whole matrix.
+  Shard()
+    : mIndex(0), mCount(1)
+  {
+  }
+
+  // Parses "i/N", throwing a RuntimeException if it is not a valid shard.
+  explicit Shard(const std::string& aSpec);
+
+  uint32_t
+  index() const
+  {
+    return mIndex;
+  }
+
+  uint32_t
+  count() const
+  {
+    return mCount;
+  }
+
+  bool
+  whole() const
+  {
+    return mCount == 1;
+  }
+
+  // Sets [aFirst, aEnd) to this shard's rows out of aRows, split into
+  // blocks of aBlockRows.
+  void rowRange(uint64_t aRows, uint64_t aBlockRows, uint64_t& aFirst,
+                uint64_t& aEnd) const;
+
+private:
+  uint32_t mIndex, mCount;
+};
+
+// Runs aCount copies of this program at once, as separate processes, with
+// the command line it was given less any --local_shards option, plus
+// --shard i/aCount and aExtraArgs. Returns true if they all succeeded.
+bool runLocalShards(int argc, char** argv, uint32_t aCount,
+                    const std::vector<std::string>& aExtraArgs =
+                    std::vector<std::string>());
+
+#endif // SHARD_HPP
@@ -0,0 +1,665 @@
+/*
+    SpearmanCoexpression: Gene-gene Spearman correlations from ranked data.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/bind.hpp>
+#include "Matrix.hpp"
+#include "RowReader.hpp"
+#include "RuntimeException.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Two doubles, to be handled by one SSE2 instruction.
+typedef double v2d __attribute__((vector_size(16)));
+
+// Computes all-pairs Pearson correlations between the rows of a matrix of
+// ranks, which makes them Spearman correlations of the data that was ranked.
+// This wants the output of RankTransformDataset --use_inverse, where each row
+// holds one gene's ranks across all the arrays.
+//
+// Each row is centred and scaled once up front, so that the correlation of
+// two complete rows is the dot product of their standardised forms. The dot
+// products are worked out in bands of rows, each band split into tiles that
+// are shared out between threads, and blocked along the arrays so that both
+// tiles stay in cache.
+//
+// Rows with NaNs are handled in one of two ways:
+//  - masked: the NaNs are left out of the row's mean and variance, and then
+//    contribute nothing to any dot product.
+//  - pairwise: a correlation involving such a row is worked out over only
+//    the arrays that are present in both rows (the ranks are used as they
+//    are, not re-ranked over the common arrays). Each such row has a mask
+//    of the arrays it has, and the tiles gather the count, sums, sums of
+//    squares and cross products over the common arrays with the masks, in
+//    the same blocks along the arrays as the dot products.
+class CoexpressionEngine
+{
+public:
+  enum NaNHandling
+  {
+    kMasked,
+    kPairwise
+  };
+
+  CoexpressionEngine(const std::string& aMatrixDir, const std::string& aRanks,
+                     NaNHandling aNaNHandling, uint32_t aThreads)
+    : mNaNHandling(aNaNHandling), mnThreads(aThreads), mnGenes(0),
+      mnArrays(0), mStride(0), mStandardised(NULL), mAllPresent(NULL),
+      mBand(NULL),
+      mBandRow0(0), mBandRows(0), mNextTile(0)
+  {
+    if (mnThreads == 0)
+      mnThreads = 1;
+
+    fs::path genes(aMatrixDir);
+    genes /= "genes";
+    readLabels(genes.string(), mGeneNames);
+    mnGenes = mGeneNames.size();
+
+    fs::path arrays(aMatrixDir);
+    arrays /= "arrays";
+    mnArrays = countLabels(arrays.string());
+
+    loadRanks(aRanks);
+  }
+
+  ~CoexpressionEngine()
+  {
+    free(mStandardised);
+    for (std::vector<double*>::iterator i = mMasks.begin();
+         i != mMasks.end(); i++)
+      if (*i != mAllPresent)
+        free(*i);
+    free(mAllPresent);
+    if (mBand != NULL)
+      delete [] mBand;
+  }
+
+  // Writes the whole nGenes x nGenes matrix of correlations, as doubles, one
+  // band of rows at a time.
+  void
+  writeMatrix(const std::string& aPath)
+  {
+    FILE* out = fopen(aPath.c_str(), "w");
+    if (out == NULL)
+      throw RuntimeException("Cannot open the output file.");
+
+    for (uint32_t row0 = 0; row0 < mnGenes; row0 += kBandRows)
+    {
+      computeBand(row0);
+      if (fwrite(mBand, sizeof(double), static_cast<uint64_t>(mBandRows) *
+                 mnGenes, out) != static_cast<uint64_t>(mBandRows) * mnGenes)
+      {
+        fclose(out);
+        throw RuntimeException("Failed to write to the output file.");
+      }
+    }
+
+    fclose(out);
+  }
+
+  // Writes the aK most positively correlated other genes for each gene, as
+  // lines of gene, neighbour and correlation separated by tabs.
+  void
+  writeTopK(const std::string& aPath, uint32_t aK)
+  {
+    std::ofstream out(aPath.c_str());
+    if (!out.good())
+      throw RuntimeException("Cannot open the output file.");
+
+    std::vector<std::pair<double, uint32_t> > candidates;
+    for (uint32_t row0 = 0; row0 < mnGenes; row0 += kBandRows)
+    {
+      computeBand(row0);
+      for (uint32_t i = 0; i < mBandRows; i++)
+      {
+        uint32_t gene = row0 + i;
+        const double* r = mBand + static_cast<uint64_t>(i) * mnGenes;
+        candidates.clear();
+        for (uint32_t j = 0; j < mnGenes; j++)
+          if (j != gene && finite(r[j]))
+            candidates.push_back(std::pair<double, uint32_t>(r[j], j));
+
+        uint32_t k = std::min(static_cast<uint32_t>(candidates.size()), aK);
+        std::partial_sort(candidates.begin(), candidates.begin() + k,
+                          candidates.end(),
+                          std::greater<std::pair<double, uint32_t> >());
+        for (uint32_t n = 0; n < k; n++)
+          out << mGeneNames[gene] << "\t"
+              << mGeneNames[candidates[n].second] << "\t"
+              << candidates[n].first << std::endl;
+      }
+    }
+  }
+
+private:
+  static const uint32_t kBandRows = 256;
+  static const uint32_t kTileRows = 64;
+  static const uint32_t kTileDepth = 512;
+
+  NaNHandling mNaNHandling;
+  uint32_t mnThreads, mnGenes, mnArrays, mStride;
+  std::vector<std::string> mGeneNames;
+  // Standardised rows, mStride apart, with NaNs and padding set to zero.
+  double* mStandardised;
+  // For pairwise-complete correlations, 1 for each array a row has and 0
+  // for each it is missing and for the padding, mStride long. Complete rows
+  // share mAllPresent, and the rest have a mask of their own.
+  double* mAllPresent;
+  std::vector<double*> mMasks;
+  // The count, sum and sum of squares of each standardised row, over the
+  // arrays it has, which are its sums with any complete row.
+  std::vector<double> mTotals;
+  double* mBand;
+  uint32_t mBandRow0, mBandRows;
+  boost::mutex mTileMutex;
+  uint32_t mNextTile;
+
+  void
+  loadRanks(const std::string& aRanks)
+  {
+    // Rows are padded out to an even length so the kernel can always work
+    // two arrays at a time.
+    mStride = (mnArrays + 1) & ~1u;
+    if (posix_memalign(reinterpret_cast<void**>(&mStandardised), 64,
+                       sizeof(double) * mStride * mnGenes) != 0)
+      throw RuntimeException("Cannot allocate the standardised matrix.");
+    memset(mStandardised, 0, sizeof(double) * mStride * mnGenes);
+    if (mNaNHandling == kPairwise)
+    {
+      mAllPresent = allocateMask();
+      for (uint32_t k = 0; k < mnArrays; k++)
+        mAllPresent[k] = 1.0;
+      mMasks.resize(mnGenes, mAllPresent);
+      mTotals.resize(3 * static_cast<uint64_t>(mnGenes));
+    }
+
+    RowReader rr(aRanks, mnArrays);
+    if (rr.rowCount() != mnGenes)
+      throw RuntimeException("The ranks file does not have one row per gene; "
+                             "was it made with --use_inverse?");
+
+    const double* row;
+    for (uint32_t g = 0; (row = rr.nextRow()) != NULL; g++)
+    {
+      double* z = mStandardised + static_cast<uint64_t>(g) * mStride;
+      double sum = 0.0, n = 0.0;
+      for (uint32_t k = 0; k < mnArrays; k++)
+        if (finite(row[k]))
+        {
+          sum += row[k];
+          n++;
+        }
+
+      if (n != mnArrays && mNaNHandling == kPairwise)
+      {
+        mMasks[g] = allocateMask();
+        for (uint32_t k = 0; k < mnArrays; k++)
+          mMasks[g][k] = finite(row[k]) ? 1.0 : 0.0;
+      }
+
+      double mean = sum / n, ss = 0.0;
+      for (uint32_t k = 0; k < mnArrays; k++)
+        if (finite(row[k]))
+        {
+          z[k] = row[k] - mean;
+          ss += z[k] * z[k];
+        }
+
+      // A constant row has no correlation with anything; make every dot
+      // product with it come out as NaN.
+      double scale = 1.0 / sqrt(ss);
+      if (n < 2 || ss == 0.0)
+        scale = std::numeric_limits<double>::quiet_NaN();
+      for (uint32_t k = 0; k < mnArrays; k++)
+        z[k] *= scale;
+
+      if (mNaNHandling == kPairwise)
+      {
+        double* totals = &mTotals[3 * static_cast<uint64_t>(g)];
+        totals[0] = n;
+        totals[1] = totals[2] = 0.0;
+        for (uint32_t k = 0; k < mnArrays; k++)
+        {
+          totals[1] += z[k];
+          totals[2] += z[k] * z[k];
+        }
+      }
+    }
+  }
+
+  double*
+  allocateMask()
+  {
+    double* mask;
+    if (posix_memalign(reinterpret_cast<void**>(&mask), 64,
+                       sizeof(double) * mStride) != 0)
+      throw RuntimeException("Cannot allocate a mask.");
+    memset(mask, 0, sizeof(double) * mStride);
+    return mask;
+  }
+
+  bool
+  hasMissing(uint32_t aGene) const
+  {
+    return mNaNHandling == kPairwise && mMasks[aGene] != mAllPresent;
+  }
+
+  void
+  computeBand(uint32_t aRow0)
+  {
+    mBandRow0 = aRow0;
+    mBandRows = std::min(kBandRows, mnGenes - aRow0);
+    if (mBand == NULL)
+      mBand = new double[static_cast<uint64_t>(kBandRows) * mnGenes];
+    mNextTile = 0;
+
+    boost::thread_group workers;
+    for (uint32_t t = 1; t < mnThreads; t++)
+      workers.create_thread(boost::bind(&CoexpressionEngine::computeTiles,
+                                        this));
+    computeTiles();
+    workers.join_all();
+  }
+
+  void
+  computeTiles()
+  {
+    uint32_t rowTiles = (mBandRows + kTileRows - 1) / kTileRows;
+    uint32_t colTiles = (mnGenes + kTileRows - 1) / kTileRows;
+
+    while (true)
+    {
+      uint32_t tile;
+      {
+        boost::mutex::scoped_lock lock(mTileMutex);
+        tile = mNextTile++;
+      }
+      if (tile >= rowTiles * colTiles)
+        return;
+
+      uint32_t i0 = (tile / colTiles) * kTileRows;
+      uint32_t j0 = (tile % colTiles) * kTileRows;
+      computeTile(i0, std::min(i0 + kTileRows, mBandRows),
+                  j0, std::min(j0 + kTileRows, mnGenes));
+    }
+  }
+
+  // Fills in band rows [aI0, aI1) against genes [aJ0, aJ1).
+  void
+  computeTile(uint32_t aI0, uint32_t aI1, uint32_t aJ0, uint32_t aJ1)
+  {
+    for (uint32_t i = aI0; i < aI1; i++)
+      memset(bandRow(i) + aJ0, 0, sizeof(double) * (aJ1 - aJ0));
+
+    // The tile's band rows and genes, in the order they are taken in. For
+    // pairwise-complete correlations, the ones missing arrays go last, so
+    // that they share as few blocks as they can with the complete ones.
+    std::vector<uint32_t> rows, cols;
+    uint32_t completeRows = tileOrder(aI0, aI1, mBandRow0, rows);
+    uint32_t completeCols = tileOrder(aJ0, aJ1, 0, cols);
+
+    // The blocks of four band rows by two genes with a row that is missing
+    // arrays, whose sums are gathered along with the dot products.
+    std::vector<PairSums> masked;
+    for (uint32_t r = 0; r < rows.size(); r += 4)
+    {
+      bool completeRow = std::min<uint32_t>(r + 4, rows.size()) <=
+        completeRows;
+      for (uint32_t c = 0; c < cols.size(); c += 2)
+      {
+        bool completeCol = std::min<uint32_t>(c + 2, cols.size()) <=
+          completeCols;
+        if (!completeRow || !completeCol)
+          masked.push_back(PairSums(r, c, completeRow, completeCol));
+      }
+    }
+
+    for (uint32_t k0 = 0; k0 < mStride; k0 += kTileDepth)
+    {
+      uint32_t k1 = std::min(k0 + kTileDepth, mStride);
+
+      uint32_t r = 0;
+      for (; r + 4 <= rows.size(); r += 4)
+      {
+        uint32_t c = 0;
+        for (; c + 2 <= cols.size(); c += 2)
+          dotBlock4x2(&rows[r], &cols[c], k0, k1);
+        for (; c < cols.size(); c++)
+          for (uint32_t rr = r; rr < r + 4; rr++)
+            bandRow(rows[rr])[cols[c]] += dot(gene(mBandRow0 + rows[rr]),
+                                              gene(cols[c]), k0, k1);
+      }
+      for (; r < rows.size(); r++)
+        for (uint32_t c = 0; c < cols.size(); c++)
+          bandRow(rows[r])[cols[c]] += dot(gene(mBandRow0 + rows[r]),
+                                           gene(cols[c]), k0, k1);
+
+      for (uint32_t b = 0; b < masked.size(); b++)
+        addPairSums(masked[b], rows, cols, k0, k1);
+    }
+
+    // The dot product of two standardised rows is already the sum of their
+    // cross products over the arrays both have.
+    for (uint32_t b = 0; b < masked.size(); b++)
+    {
+      PairSums& sums = masked[b];
+      for (uint32_t p = 0; p < 8; p++)
+      {
+        uint32_t r = sums.mRow + p / 2, c = sums.mCol + p % 2;
+        if (r >= rows.size() || c >= cols.size() ||
+            (r < completeRows && c < completeCols))
+          continue;
+        uint32_t i = rows[r], j = cols[c];
+        if (sums.mCompleteCols)
+          sums.setTotals(p, &mTotals[3 * static_cast<uint64_t>(mBandRow0 +
+                                                              i)], 1, 3);
+        if (sums.mCompleteRows)
+          sums.setTotals(p, &mTotals[3 * static_cast<uint64_t>(j)], 2, 4);
+        bandRow(i)[j] = sums.correlation(p, bandRow(i)[j]);
+      }
+    }
+  }
+
+  // Puts [aFirst, aEnd) into aOrder, those of genes aOffset + i missing
+  // arrays last, and returns how many are not.
+  uint32_t
+  tileOrder(uint32_t aFirst, uint32_t aEnd, uint32_t aOffset,
+            std::vector<uint32_t>& aOrder) const
+  {
+    for (uint32_t i = aFirst; i < aEnd; i++)
+      if (!hasMissing(aOffset + i))
+        aOrder.push_back(i);
+    uint32_t complete = aOrder.size();
+    for (uint32_t i = aFirst; i < aEnd; i++)
+      if (hasMissing(aOffset + i))
+        aOrder.push_back(i);
+    return complete;
+  }
+
+  // For the eight pairs of a block of four band rows, from mRow in the
+  // tile's order, and two genes, from mCol, the count, sums and sums of
+  // squares of each row over the arrays both have. When the genes have
+  // every array, the band rows' sums are their totals, and the other way
+  // around, so only the rest are gathered.
+  struct PairSums
+  {
+    PairSums(uint32_t aRow, uint32_t aCol, bool aCompleteRows,
+             bool aCompleteCols)
+      : mRow(aRow), mCol(aCol), mCompleteRows(aCompleteRows),
+        mCompleteCols(aCompleteCols)
+    {
+      memset(mSums, 0, sizeof(mSums));
+    }
+
+    // Sets the count and the sums aSum and aSquares of aPair from a row's
+    // totals.
+    void
+    setTotals(uint32_t aPair, const double* aTotals, uint32_t aSum,
+              uint32_t aSquares)
+    {
+      mSums[0][aPair] = aTotals[0];
+      mSums[aSum][aPair] = aTotals[1];
+      mSums[aSquares][aPair] = aTotals[2];
+    }
+
+    double
+    correlation(uint32_t aPair, double aSxy) const
+    {
+      double n = mSums[0][aPair], sx = mSums[1][aPair], sy = mSums[2][aPair],
+        sxx = mSums[3][aPair], syy = mSums[4][aPair];
+      double d = (n * sxx - sx * sx) * (n * syy - sy * sy);
+      if (n < 3 || d <= 0)
+        return std::numeric_limits<double>::quiet_NaN();
+      return (n * aSxy - sx * sy) / sqrt(d);
+    }
+
+    uint32_t mRow, mCol;
+    bool mCompleteRows, mCompleteCols;
+    double mSums[5][8];
+  };
+
+  // Adds the sums for aSums' block over arrays [aK0, aK1). The standardised
+  // rows are zero where arrays are missing, so each sum is a dot product of
+  // one row's mask with the other's mask, values or squared values, which
+  // the same kernel as the correlations works out. Centring and scaling a
+  // row do not change its correlations, so the standardised values do as
+  // well as the ranks. Rows past the end of the tile repeat its last row,
+  // and their sums are not used.
+  void
+  addPairSums(PairSums& aSums, const std::vector<uint32_t>& aRows,
+              const std::vector<uint32_t>& aCols, uint32_t aK0, uint32_t aK1)
+  {
+    const double* x[4], * mx[4], * y[2], * my[2];
+    for (uint32_t r = 0; r < 4; r++)
+    {
+      uint32_t g = mBandRow0 + aRows[std::min<uint32_t>(aSums.mRow + r,
+                                                        aRows.size() - 1)];
+      x[r] = gene(g);
+      mx[r] = mMasks[g];
+    }
+    for (uint32_t c = 0; c < 2; c++)
+    {
+      uint32_t g = aCols[std::min<uint32_t>(aSums.mCol + c,
+                                            aCols.size() - 1)];
+      y[c] = gene(g);
+      my[c] = mMasks[g];
+    }
+
+    if (!aSums.mCompleteRows && !aSums.mCompleteCols)
+      addDots4x2<false, false>(mx, my, aK0, aK1, aSums.mSums[0]);
+    if (!aSums.mCompleteCols)
+    {
+      addDots4x2<false, false>(x, my, aK0, aK1, aSums.mSums[1]);
+      addDots4x2<true, false>(x, my, aK0, aK1, aSums.mSums[3]);
+    }
+    if (!aSums.mCompleteRows)
+    {
+      addDots4x2<false, false>(mx, y, aK0, aK1, aSums.mSums[2]);
+      addDots4x2<false, true>(mx, y, aK0, aK1, aSums.mSums[4]);
+    }
+  }
+
+  double*
+  bandRow(uint32_t aRow)
+  {
+    return mBand + static_cast<uint64_t>(aRow) * mnGenes;
+  }
+
+  const double*
+  gene(uint32_t aGene)
+  {
+    return mStandardised + static_cast<uint64_t>(aGene) * mStride;
+  }
+
+  static double
+  dot(const double* aX, const double* aY, uint32_t aK0, uint32_t aK1)
+  {
+    double s = 0.0;
+    for (uint32_t k = aK0; k < aK1; k++)
+      s += aX[k] * aY[k];
+    return s;
+  }
+
+  // Adds the dot products of band rows aRows[0..3] with genes
+  // aCols[0..1], over arrays [aK0, aK1), into the band.
+  void
+  dotBlock4x2(const uint32_t* aRows, const uint32_t* aCols, uint32_t aK0,
+              uint32_t aK1)
+  {
+    const double* a[4] = { gene(mBandRow0 + aRows[0]),
+                           gene(mBandRow0 + aRows[1]),
+                           gene(mBandRow0 + aRows[2]),
+                           gene(mBandRow0 + aRows[3]) };
+    const double* b[2] = { gene(aCols[0]), gene(aCols[1]) };
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    addDots4x2<false, false>(a, b, aK0, aK1, sums);
+    for (uint32_t p = 0; p < 8; p++)
+      bandRow(aRows[p / 2])[aCols[p % 2]] += sums[p];
+  }
+
+  // Adds the dot products of rows aA[0..3] with rows aB[0..1], over arrays
+  // [aK0, aK1), to aSums, two at a time for each row of aA; with kSquareA
+  // or kSquareB, the values of those rows are squared first. Eight vector
+  // accumulators stay in registers for the whole run along the arrays.
+  template<bool kSquareA, bool kSquareB>
+  static void
+  addDots4x2(const double* const* aA, const double* const* aB, uint32_t aK0,
+             uint32_t aK1, double* aSums)
+  {
+    const double* a0 = aA[0], * a1 = aA[1], * a2 = aA[2], * a3 = aA[3];
+    const double* b0 = aB[0], * b1 = aB[1];
+    v2d c00 = { 0, 0 }, c01 = { 0, 0 }, c10 = { 0, 0 }, c11 = { 0, 0 },
+      c20 = { 0, 0 }, c21 = { 0, 0 }, c30 = { 0, 0 }, c31 = { 0, 0 };
+
+    for (uint32_t k = aK0; k < aK1; k += 2)
+    {
+      v2d y0 = *reinterpret_cast<const v2d*>(b0 + k);
+      v2d y1 = *reinterpret_cast<const v2d*>(b1 + k);
+      if (kSquareB)
+      {
+        y0 *= y0;
+        y1 *= y1;
+      }
+      v2d x = *reinterpret_cast<const v2d*>(a0 + k);
+      if (kSquareA)
+        x *= x;
+      c00 += x * y0;
+      c01 += x * y1;
+      x = *reinterpret_cast<const v2d*>(a1 + k);
+      if (kSquareA)
+        x *= x;
+      c10 += x * y0;
+      c11 += x * y1;
+      x = *reinterpret_cast<const v2d*>(a2 + k);
+      if (kSquareA)
+        x *= x;
+      c20 += x * y0;
+      c21 += x * y1;
+      x = *reinterpret_cast<const v2d*>(a3 + k);
+      if (kSquareA)
+        x *= x;
+      c30 += x * y0;
+      c31 += x * y1;
+    }
+
+    aSums[0] += c00[0] + c00[1];
+    aSums[1] += c01[0] + c01[1];
+    aSums[2] += c10[0] + c10[1];
+    aSums[3] += c11[0] + c11[1];
+    aSums[4] += c20[0] + c20[1];
+    aSums[5] += c21[0] + c21[1];
+    aSums[6] += c30[0] + c30[1];
+    aSums[7] += c31[0] + c31[1];
+  }
+};
+
+int
+main(int argc, char** argv)
+{
+  std::string matrixdir, ranks, output, nanHandling("masked");
+  uint32_t threads = 1, topK = 0;
+  po::options_description desc;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory holding the genes and arrays lists")
+    ("ranks", po::value<std::string>(&ranks),
+     "The output of RankTransformDataset --use_inverse for the matrix")
+    ("output", po::value<std::string>(&output),
+     "The file to write the correlations into")
+    ("top_k", po::value<uint32_t>(&topK),
+     "Write the top k neighbours of each gene as text, instead of the whole "
+     "correlation matrix")
+    ("nan", po::value<std::string>(&nanHandling),
+     "How to handle missing values: 'masked' (default) or 'pairwise'")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of threads to use (default 1)")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("ranks"))
+      wrong = "ranks";
+    else if (!vm.count("output"))
+      wrong = "output";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cerr << "Invalid matrix directory path supplied" << std::endl;
+    return 1;
+  }
+
+  CoexpressionEngine::NaNHandling nh;
+  if (nanHandling == "masked")
+    nh = CoexpressionEngine::kMasked;
+  else if (nanHandling == "pairwise")
+    nh = CoexpressionEngine::kPairwise;
+  else
+  {
+    std::cerr << "Invalid NaN handling supplied" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    CoexpressionEngine ce(matrixdir, ranks, nh, threads);
+    if (topK != 0)
+      ce.writeTopK(output, topK);
+    else
+      ce.writeMatrix(output);
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
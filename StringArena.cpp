@@ -0,0 +1,142 @@
+/*
+    StringArena: Interned strings allocated from a bump arena.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "StringArena.hpp"
+#include <cstring>
+
+const uint32_t StringArena::kNotFound;
+
+StringArena::StringArena()
+  : mNext(NULL), mLeft(0), mSlots(64, kNotFound)
+{
+}
+
+StringArena::~StringArena()
+{
+  clear();
+}
+
+void
+StringArena::clear()
+{
+  for (std::vector<char*>::iterator i = mChunks.begin(); i != mChunks.end();
+       i++)
+    delete [] *i;
+  mChunks.clear();
+  mNext = NULL;
+  mLeft = 0;
+
+  std::vector<boost::string_ref>().swap(mStrings);
+  std::vector<uint32_t>().swap(mHashes);
+  std::vector<uint32_t>(64, kNotFound).swap(mSlots);
+}
+
+// FNV-1a.
+uint32_t
+StringArena::hash(boost::string_ref aString)
+{
+  uint32_t h = 2166136261u;
+  for (boost::string_ref::const_iterator i = aString.begin();
+       i != aString.end(); i++)
+  {
+    h ^= static_cast<unsigned char>(*i);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// The slot holding aString, or the empty slot it would go into.
+uint32_t
+StringArena::findSlot(boost::string_ref aString, uint32_t aHash) const
+{
+  uint32_t mask = mSlots.size() - 1;
+  for (uint32_t s = aHash & mask;; s = (s + 1) & mask)
+  {
+    uint32_t id = mSlots[s];
+    if (id == kNotFound ||
+        (mHashes[id] == aHash && mStrings[id] == aString))
+      return s;
+  }
+}
+
+uint32_t
+StringArena::find(boost::string_ref aString) const
+{
+  return mSlots[findSlot(aString, hash(aString))];
+}
+
+uint32_t
+StringArena::intern(boost::string_ref aString)
+{
+  uint32_t h = hash(aString);
+  uint32_t s = findSlot(aString, h);
+  if (mSlots[s] != kNotFound)
+    return mSlots[s];
+
+  uint32_t id = mStrings.size();
+  mStrings.push_back(boost::string_ref(copy(aString), aString.size()));
+  mHashes.push_back(h);
+  mSlots[s] = id;
+
+  if (mStrings.size() * 2 > mSlots.size())
+    grow();
+  return id;
+}
+
+const char*
+StringArena::copy(boost::string_ref aString)
+{
+  uint32_t n = aString.size();
+  if (n == 0)
+    return "";
+  if (n > mLeft)
+  {
+    // Strings too big for a chunk get one of their own, and leave the
+    // current chunk to carry on with.
+    if (n > kChunkBytes / 4)
+    {
+      char* big = new char[n];
+      mChunks.push_back(big);
+      memcpy(big, aString.data(), n);
+      return big;
+    }
+    mNext = new char[kChunkBytes];
+    mChunks.push_back(mNext);
+    mLeft = kChunkBytes;
+  }
+
+  char* p = mNext;
+  memcpy(p, aString.data(), n);
+  mNext += n;
+  mLeft -= n;
+  return p;
+}
+
+void
+StringArena::grow()
+{
+  std::vector<uint32_t> slots(mSlots.size() * 2, kNotFound);
+  uint32_t mask = slots.size() - 1;
+  for (uint32_t id = 0; id < mStrings.size(); id++)
+  {
+    uint32_t s = mHashes[id] & mask;
+    while (slots[s] != kNotFound)
+      s = (s + 1) & mask;
+    slots[s] = id;
+  }
+  mSlots.swap(slots);
+}
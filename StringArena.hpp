@@ -0,0 +1,83 @@
+/*
+    StringArena: Interned strings allocated from a bump arena.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STRING_ARENA_HPP
+#define STRING_ARENA_HPP
+
+#include <boost/utility/string_ref.hpp>
+#include <vector>
+#include <stdint.h>
+
+// A set of distinct strings, each given a dense id (0, 1, 2, ... in the
+// order they were first added). The characters are copied into large
+// chunks that are only freed all together, and the strings are found
+// through an open addressing hash table of ids, so adding a string costs
+// no allocation of its own. Lookups take a string_ref, so they do not need
+// a std::string to be built either.
+class StringArena
+{
+public:
+  static const uint32_t kNotFound = 0xFFFFFFFFu;
+
+  StringArena();
+  ~StringArena();
+
+  // The id of aString, adding it if it is not there yet.
+  uint32_t intern(boost::string_ref aString);
+
+  // The id of aString, or kNotFound.
+  uint32_t find(boost::string_ref aString) const;
+
+  // The string with id aId. It stays valid until the arena is cleared.
+  boost::string_ref
+  str(uint32_t aId) const
+  {
+    return mStrings[aId];
+  }
+
+  uint32_t
+  size() const
+  {
+    return mStrings.size();
+  }
+
+  // Frees every string at once.
+  void clear();
+
+private:
+  static const uint32_t kChunkBytes = 64 << 10;
+
+  std::vector<char*> mChunks;
+  char* mNext;
+  uint32_t mLeft;
+
+  std::vector<boost::string_ref> mStrings;
+  std::vector<uint32_t> mHashes;
+  // Each slot holds an id, or kNotFound if it is empty. There are always at
+  // least twice as many slots as strings.
+  std::vector<uint32_t> mSlots;
+
+  StringArena(const StringArena&);
+  StringArena& operator=(const StringArena&);
+
+  static uint32_t hash(boost::string_ref aString);
+  uint32_t findSlot(boost::string_ref aString, uint32_t aHash) const;
+  const char* copy(boost::string_ref aString);
+  void grow();
+};
+
+#endif // STRING_ARENA_HPP
@@ -0,0 +1,110 @@
+/*
+    SummariseMatrix: Per-array and per-gene statistics of a matrix directory.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include "Matrix.hpp"
+#include "MatrixStats.hpp"
+#include "RowReader.hpp"
+#include "RuntimeException.hpp"
+#include <iostream>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+int
+main(int argc, char** argv)
+{
+  std::string matrixdir, outdir, quantiles(MatrixStats::kDefaultQuantiles);
+  uint32_t threads = 1, sketchSize = 0;
+  po::options_description desc;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory to read the data from")
+    ("outdir", po::value<std::string>(&outdir),
+     "The directory to write array_stats and gene_stats into (default "
+     "matrixdir)")
+    ("use_inverse", "Read inverse_data instead of data, so that the gene "
+     "quantiles are exact and the array ones estimated")
+    ("quantiles", po::value<std::string>(&quantiles),
+     ("The quantiles to report, as a comma separated list (default " +
+      std::string(MatrixStats::kDefaultQuantiles) + ")").c_str())
+    ("sketch_size", po::value<uint32_t>(&sketchSize),
+     "The number of values each level of a quantile sketch holds; larger "
+     "is more accurate (default 128, or less if the sketches would take "
+     "more than 512 MB)")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of threads to gather the statistics on (default 1)")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cerr << "Invalid matrix directory path supplied" << std::endl;
+    return 1;
+  }
+  if (outdir == "")
+    outdir = matrixdir;
+
+  try
+  {
+    bool inverse = vm.count("use_inverse") != 0;
+    fs::path dir(matrixdir);
+    uint32_t columns = countLabels((dir / (inverse ? "arrays" : "genes"))
+                                   .string());
+
+    RowReader data((dir / (inverse ? "inverse_data" : "data")).string(),
+                   columns);
+    MatrixStats stats(columns, MatrixStats::parseQuantiles(quantiles),
+                      sketchSize, data.rowCount());
+    stats.printSketchSize(data.rowCount());
+    uint32_t nrows;
+    const double* rows;
+    while ((rows = data.nextBlock(nrows)) != NULL)
+      stats.addRows(rows, nrows, threads);
+
+    stats.write(matrixdir, outdir, inverse);
+  }
+  catch (RuntimeException& e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
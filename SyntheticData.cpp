@@ -0,0 +1,257 @@
+/*
+    SyntheticData: Generate SOFT files, HGNC tables and matrices for benchmarks.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "SyntheticData.hpp"
+#include "RuntimeException.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+
+// Writes one approved row of a conflict group, whose names all start with
+// CONFLICT<group>.
+static void
+writeConflictRow(FILE* aFile, uint32_t aGenes, uint32_t aGroup, uint32_t aId,
+                 const char* aApproved, const char* aPrevious,
+                 const char* aAliases)
+{
+  uint32_t id = syntheticConflictId(aGenes, aGroup, aId);
+  fprintf(aFile, "%u\tCONFLICT%u%s\tname %u\tApproved\t", id, aGroup,
+          aApproved, id);
+  if (*aPrevious != 0)
+    fprintf(aFile, "CONFLICT%u%s", aGroup, aPrevious);
+  fprintf(aFile, "\t");
+  for (const char* a = aAliases; *a != 0; a += strlen(a) + 1)
+    fprintf(aFile, "%sCONFLICT%u%s", a == aAliases ? "" : ", ", aGroup, a);
+  fprintf(aFile, "\n");
+}
+
+// The first rows of a conflict group claim names...
+static void
+writeEarlyConflicts(FILE* aFile, uint32_t aGenes, uint32_t aGroup)
+{
+  writeConflictRow(aFile, aGenes, aGroup, 0, "A", "PREV", "ALIAS\0ALIASB\0");
+  writeConflictRow(aFile, aGenes, aGroup, 1, "DUP", "", "");
+  writeConflictRow(aFile, aGenes, aGroup, 2, "FIRST", "", "");
+  writeConflictRow(aFile, aGenes, aGroup, 3, "KEEP", "", "");
+}
+
+// ...that the rest, further on in the file, claim again.
+static void
+writeLateConflicts(FILE* aFile, uint32_t aGenes, uint32_t aGroup)
+{
+  writeConflictRow(aFile, aGenes, aGroup, 4, "PREV", "", "KEEP\0");
+  writeConflictRow(aFile, aGenes, aGroup, 5, "DUP", "", "");
+  writeConflictRow(aFile, aGenes, aGroup, 2, "SECOND", "", "");
+  writeConflictRow(aFile, aGenes, aGroup, 6, "B", "", "ALIAS\0");
+  writeConflictRow(aFile, aGenes, aGroup, 7, "ALIASB", "", "");
+}
+
+void
+writeSyntheticHGNC(const std::string& aPath, uint32_t aGenes)
+{
+  FILE* f = fopen(aPath.c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the synthetic HGNC file.");
+
+  fprintf(f, "HGNC ID\tApproved Symbol\tApproved Name\tStatus\t"
+          "Previous Symbols\tAliases\n");
+
+  // Each conflict group starts at one point in the file and finishes at
+  // the next, so that between them the groups span every place a chunk
+  // boundary could fall.
+  uint32_t group = 0;
+  for (uint32_t i = 0; i < aGenes; i++)
+  {
+    fprintf(f, "%u\tGENE%u\tname %u\t%s\tOLD%u, PREV%u\tALIAS%u\n", i + 1, i,
+            i, i % 17 == 0 ? "Withdrawn" : "Approved", i, i, i % 500);
+    while (group < kSyntheticHGNCConflicts &&
+           i + 1 == static_cast<uint64_t>(aGenes) * (group + 1) /
+           (kSyntheticHGNCConflicts + 1))
+    {
+      if (group > 0)
+        writeLateConflicts(f, aGenes, group - 1);
+      writeEarlyConflicts(f, aGenes, group++);
+    }
+  }
+  for (; group < kSyntheticHGNCConflicts; group++)
+  {
+    if (group > 0)
+      writeLateConflicts(f, aGenes, group - 1);
+    writeEarlyConflicts(f, aGenes, group);
+  }
+  writeLateConflicts(f, aGenes, kSyntheticHGNCConflicts - 1);
+  fclose(f);
+}
+
+uint32_t
+syntheticConflictId(uint32_t aGenes, uint32_t aGroup, uint32_t aRow)
+{
+  return aGenes + 1 + 8 * aGroup + aRow;
+}
+
+std::string
+syntheticSymbol(boost::random::mt19937& aRng, uint32_t aGenes)
+{
+  boost::random::uniform_int_distribution<uint32_t> gene(0, aGenes - 1);
+  double r = boost::random::uniform_01<double>()(aRng);
+  char buf[32];
+
+  if (r < 0.6)
+    snprintf(buf, sizeof(buf), "GENE%u", gene(aRng));
+  else if (r < 0.75)
+    snprintf(buf, sizeof(buf), "OLD%u", gene(aRng));
+  else if (r < 0.85)
+    snprintf(buf, sizeof(buf), "ALIAS%u", gene(aRng) % 500);
+  else if (r < 0.9)
+    snprintf(buf, sizeof(buf), "GENE-%u", gene(aRng));
+  else
+    snprintf(buf, sizeof(buf), "UNKNOWN%u", gene(aRng));
+  return buf;
+}
+
+static void
+emitLine(std::ostream& aOut, const std::string& aLine, uint64_t& aBytes)
+{
+  aOut << aLine << '\n';
+  aBytes += aLine.size() + 1;
+}
+
+uint64_t
+writeSyntheticSOFT(const std::string& aPath, const SyntheticSOFTShape& aShape)
+{
+  io::filtering_ostream out;
+  if (aShape.mCompression == "gzip")
+    out.push(io::gzip_compressor());
+  else if (aShape.mCompression == "bzip2")
+    out.push(io::bzip2_compressor());
+  else if (aShape.mCompression != "none")
+    throw RuntimeException("Unknown compression for the synthetic SOFT file.");
+  out.push(io::file_sink(aPath, std::ios::binary));
+  if (!out.good())
+    throw RuntimeException("Cannot open the synthetic SOFT file.");
+
+  boost::random::mt19937 rng(aShape.mSeed);
+  boost::random::uniform_01<double> u;
+  boost::random::normal_distribution<double> value(8.0, 2.0);
+  uint64_t bytes = 0;
+
+  char buf[64];
+  emitLine(out, "^DATABASE = GeoMiame", bytes);
+  emitLine(out, "^PLATFORM = GPL1", bytes);
+  emitLine(out, "!Platform_title = Synthetic platform", bytes);
+  for (uint32_t s = 0; s < aShape.mSamples; s++)
+  {
+    snprintf(buf, sizeof(buf), "!Platform_sample_id = GSM%u", s);
+    emitLine(out, buf, bytes);
+  }
+
+  emitLine(out, "!platform_table_begin", bytes);
+  emitLine(out, "ID\tGB_ACC\tGene Symbol", bytes);
+  for (uint32_t p = 0; p < aShape.mProbesets; p++)
+  {
+    snprintf(buf, sizeof(buf), "P%u_at\tX%u\t", p, p);
+    std::string l(buf);
+    double r = u(rng);
+    if (r < 0.1)
+      ; // No symbol at all.
+    else if (r < 0.1 + aShape.mMultiGeneFraction)
+      l += syntheticSymbol(rng, aShape.mGenes) + " // " +
+        syntheticSymbol(rng, aShape.mGenes);
+    else
+      l += syntheticSymbol(rng, aShape.mGenes);
+    emitLine(out, l, bytes);
+  }
+  emitLine(out, "!platform_table_end", bytes);
+
+  for (uint32_t s = 0; s < aShape.mSamples; s++)
+  {
+    snprintf(buf, sizeof(buf), "^SAMPLE = GSM%u", s);
+    emitLine(out, buf, bytes);
+    emitLine(out, "!Sample_title = Synthetic sample", bytes);
+    if (u(rng) < aShape.mMissingTableFraction)
+      continue;
+
+    emitLine(out, "!sample_table_begin", bytes);
+    emitLine(out, "ID_REF\tVALUE\tDETECTION", bytes);
+    for (uint32_t p = 0; p < aShape.mProbesets; p++)
+    {
+      double r = u(rng);
+      if (r < aShape.mMissingValueFraction / 2)
+        continue;
+      if (r < aShape.mMissingValueFraction)
+        snprintf(buf, sizeof(buf), "P%u_at\tnull\tA", p);
+      else
+        snprintf(buf, sizeof(buf), "P%u_at\t%.4f\tP", p, value(rng));
+      emitLine(out, buf, bytes);
+    }
+    // Platforms often leave out probes the samples list.
+    emitLine(out, "UNLISTED_at\t1.0\tP", bytes);
+    emitLine(out, "!sample_table_end", bytes);
+  }
+  out.reset();
+  return bytes;
+}
+
+void
+writeSyntheticMatrix(const std::string& aDir, uint32_t aArrays,
+                     uint32_t aGenes, double aNaNFraction, uint64_t aSeed)
+{
+  fs::path dir(aDir);
+  fs::create_directories(dir);
+
+  std::ofstream arrays((dir / "arrays").string().c_str());
+  for (uint32_t a = 0; a < aArrays; a++)
+    arrays << "GSM" << a << std::endl;
+  std::ofstream genes((dir / "genes").string().c_str());
+  for (uint32_t g = 0; g < aGenes; g++)
+    genes << "GENE" << g << std::endl;
+
+  FILE* f = fopen((dir / "data").string().c_str(), "w");
+  if (f == NULL)
+    throw RuntimeException("Cannot open the synthetic data file.");
+
+  boost::random::mt19937 rng(aSeed);
+  boost::random::uniform_01<double> u;
+  boost::random::normal_distribution<double> value;
+  std::vector<double> row(aGenes);
+  for (uint32_t a = 0; a < aArrays; a++)
+  {
+    for (uint32_t g = 0; g < aGenes; g++)
+      row[g] = u(rng) < aNaNFraction ?
+        std::numeric_limits<double>::quiet_NaN() : value(rng);
+    if (aGenes != 0 && fwrite(&row[0], sizeof(double), aGenes, f) != aGenes)
+    {
+      fclose(f);
+      throw RuntimeException("Failed to write the synthetic data file.");
+    }
+  }
+  fclose(f);
+}
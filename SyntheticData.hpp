@@ -0,0 +1,89 @@
+/*
+    SyntheticData: Generate SOFT files, HGNC tables and matrices for benchmarks.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SYNTHETIC_DATA_HPP
+#define SYNTHETIC_DATA_HPP
+
+#include <boost/random/mersenne_twister.hpp>
+#include <string>
+#include <stdint.h>
+
+// The shape of a synthetic SOFT file: one platform, then a table for each
+// sample. The symbols are drawn from the genes of writeSyntheticHGNC().
+struct SyntheticSOFTShape
+{
+  SyntheticSOFTShape()
+    : mProbesets(20000), mSamples(200), mGenes(10000),
+      mMultiGeneFraction(0.2), mMissingTableFraction(0.05),
+      mMissingValueFraction(0.02), mSeed(1), mCompression("none")
+  {
+  }
+
+  uint32_t mProbesets, mSamples, mGenes;
+
+  // The fraction of probesets listing several symbols separated by " // ",
+  // of samples with no table, and of values left out of a table or null.
+  double mMultiGeneFraction, mMissingTableFraction, mMissingValueFraction;
+
+  uint64_t mSeed;
+
+  // "none", "gzip" or "bzip2".
+  std::string mCompression;
+};
+
+// Writes an HGNC table of aGenes genes, GENE<n>, each with two previous
+// symbols, OLD<n> and PREV<n>, and an alias ALIAS<n % 500>. Every 17th gene
+// is withdrawn.
+//
+// Spread through it are kSyntheticHGNCConflicts groups of rows whose names,
+// CONFLICT<g> followed by a suffix, test HGNCDatabase's precedence rules.
+// Row r of group g has the id syntheticConflictId(aGenes, g, r), and the
+// rows come in this order, the last five some way after the first four:
+//
+//   row  approved  previous  aliases
+//   0    A         PREV      ALIAS, ALIASB
+//   1    DUP
+//   2    FIRST
+//   3    KEEP
+//   4    PREV                KEEP
+//   5    DUP
+//   2    SECOND
+//   6    B                   ALIAS
+//   7    ALIASB
+void writeSyntheticHGNC(const std::string& aPath, uint32_t aGenes);
+
+static const uint32_t kSyntheticHGNCConflicts = 16;
+
+uint32_t syntheticConflictId(uint32_t aGenes, uint32_t aGroup, uint32_t aRow);
+
+// Writes a SOFT file of the given shape, and returns its size before
+// compression.
+uint64_t writeSyntheticSOFT(const std::string& aPath,
+                            const SyntheticSOFTShape& aShape);
+
+// Writes a matrix directory (arrays, genes and data) of aArrays rows of
+// aGenes normally distributed values, aNaNFraction of which are NaN.
+void writeSyntheticMatrix(const std::string& aDir, uint32_t aArrays,
+                          uint32_t aGenes, double aNaNFraction,
+                          uint64_t aSeed);
+
+// A single gene name, as a platform might give it: mostly approved symbols
+// of the first aGenes genes, with some previous symbols, aliases, names
+// with dashes and names no table has.
+std::string syntheticSymbol(boost::random::mt19937& aRng, uint32_t aGenes);
+
+#endif // SYNTHETIC_DATA_HPP
@@ -0,0 +1,200 @@
+/*
+    TransposeWriter: Write out the transpose of a matrix given row by row.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "TransposeWriter.hpp"
+#include "RuntimeException.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+
+TransposeWriter::TransposeWriter(const std::string& aPath, uint32_t aRows,
+                                 uint32_t aColumns, uint32_t aBandRows,
+                                 uint32_t aFirstRow, uint32_t aEndRow)
+  : mFile(NULL), mnRows(aRows), mnColumns(aColumns), mBandRows(aBandRows),
+    mEndRow(aEndRow < aRows ? aEndRow : aRows), mRowsWritten(aFirstRow),
+    mBandFill(0), mBand(NULL), mSmallBuf(NULL), mFinished(false),
+    mRowsTransposed(Profile::counter("rows_transposed")),
+    mBandTimer(Profile::timer("transpose_band_write"))
+{
+  if (aFirstRow == 0 && mEndRow == mnRows)
+    mFile = fopen(aPath.c_str(), "w");
+  else
+  {
+    // Other rows are, or will be, written by someone else, so the file is
+    // only brought up to its full size, never cut short or emptied.
+    int fd = open(aPath.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(mnRows) * mnColumns *
+                             sizeof(double)) == 0)
+      mFile = fdopen(fd, "r+");
+    if (mFile == NULL && fd >= 0)
+      close(fd);
+  }
+  if (mFile == NULL)
+    throw RuntimeException("Cannot open the transposed output file.");
+
+  mSmallBuf = new double[mBandRows];
+}
+
+TransposeWriter::~TransposeWriter()
+{
+  if (!mFinished)
+    finish();
+  fclose(mFile);
+  if (mBand != NULL)
+    delete [] mBand;
+  delete [] mSmallBuf;
+}
+
+void
+TransposeWriter::addRow(const double* aRow)
+{
+  addRows(aRow, 1);
+}
+
+void
+TransposeWriter::addRows(const double* aRows, uint32_t aCount)
+{
+  while (mBandFill == 0 && aCount >= mBandRows)
+  {
+    writeBand(aRows, mBandRows);
+    aRows += static_cast<uint64_t>(mBandRows) * mnColumns;
+    aCount -= mBandRows;
+  }
+
+  while (aCount > 0)
+  {
+    if (mBand == NULL)
+      mBand = new double[static_cast<uint64_t>(mBandRows) * mnColumns];
+
+    uint32_t n = mBandRows - mBandFill;
+    if (n > aCount)
+      n = aCount;
+    memcpy(mBand + static_cast<uint64_t>(mBandFill) * mnColumns, aRows,
+           static_cast<uint64_t>(n) * mnColumns * sizeof(double));
+    mBandFill += n;
+    aRows += static_cast<uint64_t>(n) * mnColumns;
+    aCount -= n;
+
+    if (mBandFill == mBandRows)
+    {
+      writeBand(mBand, mBandFill);
+      mBandFill = 0;
+    }
+  }
+}
+
+void
+TransposeWriter::finish()
+{
+  if (mFinished)
+    return;
+  mFinished = true;
+
+  if (mBandFill != 0)
+  {
+    writeBand(mBand, mBandFill);
+    mBandFill = 0;
+  }
+
+  if (mRowsWritten >= mEndRow)
+    return;
+
+  double* nans = new double[mnColumns];
+  for (uint32_t i = 0; i < mnColumns; i++)
+    nans[i] = std::numeric_limits<double>::quiet_NaN();
+  while (mRowsWritten < mEndRow)
+    writeBand(nans, 1);
+  delete [] nans;
+}
+
+void
+TransposeWriter::widen(const std::string& aFrom, const std::string& aTo,
+                       uint32_t aColumns, uint32_t aOldRows,
+                       uint32_t aNewRows)
+{
+  if (aNewRows < aOldRows)
+    throw RuntimeException("The transposed file cannot be narrowed.");
+
+  int in = open(aFrom.c_str(), O_RDONLY);
+  if (in < 0)
+    throw RuntimeException("Cannot open the transposed file to widen it.");
+  int out = open(aTo.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (out < 0 || ftruncate(out, static_cast<off_t>(aColumns) * aNewRows *
+                           sizeof(double)) != 0)
+  {
+    close(in);
+    if (out >= 0)
+      close(out);
+    throw RuntimeException("Cannot create the widened transposed file.");
+  }
+
+  // Lines are copied kWidenBytes or so at a time, each to its place in the
+  // longer lines of the new file.
+  uint64_t oldBytes = static_cast<uint64_t>(aOldRows) * sizeof(double);
+  uint64_t newBytes = static_cast<uint64_t>(aNewRows) * sizeof(double);
+  uint32_t linesPerChunk = oldBytes == 0 ? aColumns : kWidenBytes / oldBytes;
+  if (linesPerChunk == 0)
+    linesPerChunk = 1;
+  char* buf = new char[linesPerChunk * oldBytes + 1];
+
+  const char* error = NULL;
+  for (uint32_t start = 0; oldBytes != 0 && start < aColumns && error == NULL;
+       start += linesPerChunk)
+  {
+    uint32_t end = std::min(aColumns, start + linesPerChunk);
+    uint64_t want = (end - start) * oldBytes;
+    if (pread(in, buf, want, start * oldBytes) != static_cast<ssize_t>(want))
+      error = "The transposed file is truncated.";
+    for (uint32_t line = start; error == NULL && line < end; line++)
+      if (pwrite(out, buf + (line - start) * oldBytes, oldBytes,
+                 line * newBytes) != static_cast<ssize_t>(oldBytes))
+        error = "Failed to widen the transposed file.";
+  }
+
+  delete [] buf;
+  close(in);
+  if (close(out) != 0 && error == NULL)
+    error = "Failed to widen the transposed file.";
+  if (error != NULL)
+    throw RuntimeException(error);
+}
+
+void
+TransposeWriter::writeBand(const double* aRows, uint32_t aCount)
+{
+  uint32_t row0 = mRowsWritten, rownext = mRowsWritten + aCount;
+  if (rownext > mEndRow)
+    throw RuntimeException("More rows were given than were expected.");
+
+  ScopedProfileTimer timer(mBandTimer);
+  fseek(mFile, row0 * sizeof(double), SEEK_SET);
+
+  for (uint32_t col = 0; col < mnColumns; col++)
+  {
+    const double* p = aRows + col;
+    for (uint32_t i = 0; i < aCount; i++)
+      mSmallBuf[i] = p[static_cast<uint64_t>(mnColumns) * i];
+    fwrite(mSmallBuf, aCount, sizeof(double), mFile);
+    if (col + 1 < mnColumns)
+      fseek(mFile, (mnRows - rownext + row0) * sizeof(double), SEEK_CUR);
+  }
+
+  mRowsWritten = rownext;
+  mRowsTransposed.add(aCount);
+}
@@ -0,0 +1,78 @@
+/*
+    TransposeWriter: Write out the transpose of a matrix given row by row.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRANSPOSE_WRITER_HPP
+#define TRANSPOSE_WRITER_HPP
+
+#include "Profile.hpp"
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+
+// Writes the transpose of an aRows x aColumns matrix of doubles into a file,
+// taking the matrix one or more rows at a time. Rows are gathered into bands
+// of aBandRows, and each band is written out column by column, so each
+// write covers aBandRows values of one row of the output.
+//
+// With aFirstRow, the transposes of rows before it are taken to be in the
+// file already, and only the rows from aFirstRow on are added to it. With
+// aEndRow as well, only rows [aFirstRow, aEndRow) are written, and the rest
+// of the file is left alone, so that several writers can each fill in
+// their own range of rows.
+class TransposeWriter
+{
+public:
+  TransposeWriter(const std::string& aPath, uint32_t aRows, uint32_t aColumns,
+                  uint32_t aBandRows = kDefaultBandRows,
+                  uint32_t aFirstRow = 0, uint32_t aEndRow = kAllRows);
+  ~TransposeWriter();
+
+  // Copies the transpose of an aOldRows x aColumns matrix in aFrom into a
+  // new file aTo, spread out to have room for aNewRows rows, ready for a
+  // TransposeWriter starting at aOldRows to fill in the rest. aFrom is left
+  // as it was.
+  static void widen(const std::string& aFrom, const std::string& aTo,
+                    uint32_t aColumns, uint32_t aOldRows, uint32_t aNewRows);
+
+  void addRow(const double* aRow);
+
+  // Adds aCount consecutive rows. Whole bands are written straight from
+  // aRows rather than being copied into the band buffer first.
+  void addRows(const double* aRows, uint32_t aCount);
+
+  // Writes out any partial band. If fewer than aEndRow (or aRows) rows were
+  // added, the missing ones are written as NaNs, so the output always has
+  // its full size.
+  void finish();
+
+  static const uint32_t kDefaultBandRows = 3000;
+  static const uint32_t kWidenBytes = 64 << 20;
+  static const uint32_t kAllRows = ~0u;
+
+private:
+  FILE* mFile;
+  uint32_t mnRows, mnColumns, mBandRows, mEndRow;
+  uint32_t mRowsWritten, mBandFill;
+  double* mBand, * mSmallBuf;
+  bool mFinished;
+  ProfileCounter& mRowsTransposed;
+  ProfileTimer& mBandTimer;
+
+  void writeBand(const double* aRows, uint32_t aCount);
+};
+
+#endif // TRANSPOSE_WRITER_HPP